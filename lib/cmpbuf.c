@@ -107,3 +107,102 @@ buffer_lcm (size_t a, size_t b, size_t lcm_max)
   lcm = q * b;
   return lcm <= lcm_max && lcm / b == q ? lcm : a;
 }
+
+/* Set up *C for reading the regular file FD from offset POS.  */
+
+void
+hole_cursor_init (struct hole_cursor *c, int fd, off_t pos)
+{
+  c->fd = fd;
+  c->pos = pos;
+  c->extent_end = pos;
+  c->in_hole = false;
+}
+
+/* Find the extent of C's file that contains C->pos, using SEEK_DATA and
+   SEEK_HOLE, and leave the file offset at C->pos.  Treat the file as
+   all data if it has no holes or if the system cannot tell.
+   Return 0 on success, -1 (setting errno) if the file offset cannot
+   be restored.  */
+
+static int
+find_extent (struct hole_cursor *c)
+{
+  c->extent_end = TYPE_MAXIMUM (off_t);
+  c->in_hole = false;
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+  off_t data = lseek (c->fd, c->pos, SEEK_DATA);
+  if (data < 0)
+    {
+      /* ENXIO means there is no data at or after POS: either POS is at
+         or past the end of the file, or the rest of the file is a hole.  */
+      if (errno == ENXIO)
+        {
+          off_t size = lseek (c->fd, 0, SEEK_END);
+          if (c->pos < size)
+            {
+              c->extent_end = size;
+              c->in_hole = true;
+            }
+        }
+    }
+  else if (c->pos < data)
+    {
+      c->extent_end = data;
+      c->in_hole = true;
+    }
+  else
+    {
+      off_t hole = lseek (c->fd, c->pos, SEEK_HOLE);
+      if (c->pos < hole)
+        c->extent_end = hole;
+    }
+
+  if (lseek (c->fd, c->pos, SEEK_SET) < 0)
+    return -1;
+#endif
+
+  return 0;
+}
+
+/* If both cursors in C are in holes, which read as zeros, skip to the
+   nearer end of the two holes, but by no more than LIMIT bytes, so
+   that the caller need not read bytes that are known to be equal.
+   Look up the extents only when a cursor has left its known extent,
+   and the second file's only when the first file is in a hole, so
+   that files without holes cost a few system calls in all.
+   Return the number of bytes skipped in each file.  On error, set
+   errno and the failing cursor's position to -1, and return -1.  */
+
+off_t
+skip_common_holes (struct hole_cursor c[2], off_t limit)
+{
+  off_t skip = limit;
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      if (c[f].extent_end <= c[f].pos && find_extent (&c[f]) != 0)
+        {
+          c[f].pos = -1;
+          return -1;
+        }
+      if (! c[f].in_hole)
+        return 0;
+      skip = MIN (skip, c[f].extent_end - c[f].pos);
+    }
+
+  if (skip <= 0)
+    return 0;
+  for (f = 0; f < 2; f++)
+    {
+      c[f].pos += skip;
+      if (lseek (c[f].fd, c[f].pos, SEEK_SET) < 0)
+        {
+          c[f].pos = -1;
+          return -1;
+        }
+    }
+  return skip;
+}
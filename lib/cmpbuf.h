@@ -15,5 +15,21 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+#include <stdbool.h>
+#include <sys/types.h>
+
 size_t block_read (int, char *, size_t);
 size_t buffer_lcm (size_t, size_t, size_t) _GL_ATTRIBUTE_CONST;
+
+/* The position of a reader in a regular file, and what is known about
+   the data or hole extent that contains that position.  */
+struct hole_cursor
+{
+  int fd;               /* File descriptor.  */
+  off_t pos;            /* File offset; callers advance it as they read.  */
+  off_t extent_end;     /* End of the known extent containing POS.  */
+  bool in_hole;         /* Whether that extent is a hole.  */
+};
+
+void hole_cursor_init (struct hole_cursor *, int, off_t);
+off_t skip_common_holes (struct hole_cursor[2], off_t);
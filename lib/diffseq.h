@@ -58,6 +58,24 @@
                              early abort of the computation.
      USE_HEURISTIC           (Optional) Define if you want to support the
                              heuristic for large vectors.
+     SPAWN_SUBPROBLEM(ctxt, xoff, xlim, yoff, ylim, find_minimal)
+                             (Optional) A boolean expression that may hand
+                             the subproblem to another thread, which must
+                             call compareseq on it with a context of its
+                             own, and that yields true if it did so.
+                             Results are then recorded out of order, so
+                             NOTE_ORDERED must be false.
+     CHARGE_COST(ctxt, cost) (Optional) A boolean expression that accounts for
+                             COST more diagonals searched for a partition,
+                             and that yields true if the search should settle
+                             for the best partition found so far, as it does
+                             when it grows too expensive.
+     SOLVE_SUBPROBLEM(ctxt, xoff, xlim, yoff, ylim)
+                             (Optional) A boolean expression that may find a
+                             minimal edit script for the subproblem by other
+                             means, recording it as NOTE_DELETE and
+                             NOTE_INSERT would, and that yields true if it
+                             did so.
 
    It is also possible to use this file with abstract arrays.  In this case,
    xvec and yvec are not represented in memory.  They only exist conceptually.
@@ -87,6 +105,21 @@
 # define NOTE_ORDERED false
 #endif
 
+/* Default to doing all the work in the calling thread.  */
+#ifndef SPAWN_SUBPROBLEM
+# define SPAWN_SUBPROBLEM(ctxt, xoff, xlim, yoff, ylim, find_minimal) false
+#endif
+
+/* Default to no budget for the search.  */
+#ifndef CHARGE_COST
+# define CHARGE_COST(ctxt, cost) false
+#endif
+
+/* Default to solving all subproblems by dividing them.  */
+#ifndef SOLVE_SUBPROBLEM
+# define SOLVE_SUBPROBLEM(ctxt, xoff, xlim, yoff, ylim) false
+#endif
+
 /* Use this to suppress gcc's "...may be used before initialized" warnings.
    Beware: The Code argument must not contain commas.  */
 #ifndef IF_LINT
@@ -275,7 +308,10 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim, bool find_minimal,
             }
         }
 
-      if (find_minimal)
+      bool over_budget = CHARGE_COST (ctxt, ((fmax - fmin) / 2
+                                             + (bmax - bmin) / 2 + 2));
+
+      if (find_minimal && !over_budget)
         continue;
 
 #ifdef USE_HEURISTIC
@@ -375,7 +411,7 @@ diag (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim, bool find_minimal,
 
       /* Heuristic: if we've gone well beyond the call of duty, give up
          and report halfway between our best results so far.  */
-      if (c >= ctxt->too_expensive)
+      if (c >= ctxt->too_expensive || over_budget)
         {
           OFFSET fxybest;
           OFFSET fxbest IF_LINT (= 0);
@@ -508,6 +544,9 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
           break;
         }
 
+      if (SOLVE_SUBPROBLEM (ctxt, xoff, xlim, yoff, ylim))
+        break;
+
       struct partition part;
 
       /* Find a point of correspondence in the middle of the vectors.  */
@@ -542,10 +581,18 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
           find_minimal2 = part.hi_minimal;
         }
 
-      /* Recurse to do one subproblem.  */
-      bool early = compareseq (xoff1, xlim1, yoff1, ylim1, find_minimal1, ctxt);
-      if (early)
-        return early;
+      /* Recurse to do one subproblem, unless another thread takes it.
+         The subproblems are independent, and diag's results do not
+         depend on what FDIAG and BDIAG held before, so the results are
+         the same either way.  */
+      if (! SPAWN_SUBPROBLEM (ctxt, xoff1, xlim1, yoff1, ylim1,
+                              find_minimal1))
+        {
+          bool early = compareseq (xoff1, xlim1, yoff1, ylim1,
+                                   find_minimal1, ctxt);
+          if (early)
+            return early;
+        }
 
       /* Iterate to do the other subproblem.  */
       xoff = xoff2; xlim = xlim2;
@@ -565,5 +612,8 @@ compareseq (OFFSET xoff, OFFSET xlim, OFFSET yoff, OFFSET ylim,
 #undef NOTE_INSERT
 #undef EARLY_ABORT
 #undef USE_HEURISTIC
+#undef SPAWN_SUBPROBLEM
+#undef CHARGE_COST
+#undef SOLVE_SUBPROBLEM
 #undef XVECREF_YVECREF_EQUAL
 #undef OFFSET_MAX
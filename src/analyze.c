@@ -22,52 +22,79 @@
 #include <cmpbuf.h>
 #include <error.h>
 #include <file-type.h>
+#include <timespec.h>
 #include <xalloc.h>
 
-/* The core of the Diff algorithm.  */
-#define ELEMENT lin
-#define EQUAL(x,y) ((x) == (y))
-#define OFFSET lin
-#define EXTRA_CONTEXT_FIELDS /* none */
-#define NOTE_DELETE(c, xoff) (files[0].changed[files[0].realindexes[xoff]] = 1)
-#define NOTE_INSERT(c, yoff) (files[1].changed[files[1].realindexes[yoff]] = 1)
-#define USE_HEURISTIC 1
-#include <diffseq.h>
+#include <stdint.h>
+
+/* The budget for comparing two files: how many diagonals diag may
+   search in all (--cost-budget), and for how long (--time-budget).  */
+static struct
+{
+  intmax_t cost_spent;
+  struct timespec start;
+  enum budget_level level;
+} budget;
+
+/* Start the budget for comparing two files.  */
+
+static void
+start_budget (void)
+{
+  budget.cost_spent = 0;
+  budget.start = current_timespec ();
+  budget.level = WITHIN_BUDGET;
+}
+
+/* Add COST diagonals to those searched in comparing two files, and
+   return how much of its budget the comparison has used.  Threads that
+   compare the same files must not call this at the same time.  */
+
+enum budget_level
+spend_budget (intmax_t cost)
+{
+  budget.cost_spent += cost;
+  if (budget.level != OVER_BUDGET && (cost_budget || time_budget))
+    {
+      struct timespec now = current_timespec ();
+      intmax_t nsec = ((intmax_t) (now.tv_sec - budget.start.tv_sec)
+                       * TIMESPEC_HZ
+                       + now.tv_nsec - budget.start.tv_nsec);
+      if ((cost_budget && cost_budget <= budget.cost_spent)
+          || (time_budget && time_budget <= nsec))
+        budget.level = OVER_BUDGET;
+      else if ((cost_budget && cost_budget <= 2 * budget.cost_spent)
+               || (time_budget && time_budget <= 2 * nsec))
+        budget.level = OVER_HALF_BUDGET;
+    }
+  return budget.level;
+}
 
 /* Discard lines from one file that have no matches in the other file.
 
    A line which is discarded will not be considered by the actual
    comparison algorithm; it will be as if that line were not in the file.
-   The file's 'realindexes' table maps virtual line numbers
-   (which don't count the discarded lines) into real line numbers;
-   this is how the actual comparison algorithm produces results
-   that are comprehensible when the discarded lines are counted.
+   Set DISCARDED[F][I] to 1 if line I of file F is discarded, and to 0
+   otherwise; compare_lines maps the indexes of the lines left into
+   real line numbers, so that its results are comprehensible when the
+   discarded lines are counted.  The caller must give back DISCARDED[0]
+   as SPARE_DISCARDS.
 
    When we discard a line, we also mark it as a deletion or insertion
    so that it will be printed in the output.  */
 
 static void
-discard_confusing_lines (struct file_data filevec[])
+discard_confusing_lines (struct file_data filevec[], char *discarded[2])
 {
   int f;
   lin i;
-  char *discarded[2];
   lin *equiv_count[2];
   lin *p;
 
-  /* Allocate our results.  */
-  p = xmalloc ((filevec[0].buffered_lines + filevec[1].buffered_lines)
-               * (2 * sizeof *p));
-  for (f = 0; f < 2; f++)
-    {
-      filevec[f].undiscarded = p;  p += filevec[f].buffered_lines;
-      filevec[f].realindexes = p;  p += filevec[f].buffered_lines;
-    }
-
   /* Set up equiv_count[F][I] as the number of lines in file F
      that fall in equivalence class I.  */
 
-  p = zalloc (filevec[0].equiv_max * (2 * sizeof *p));
+  p = spare_ztake (SPARE_COUNTS, filevec[0].equiv_max, 2 * sizeof *p);
   equiv_count[0] = p;
   equiv_count[1] = p + filevec[0].equiv_max;
 
@@ -78,8 +105,9 @@ discard_confusing_lines (struct file_data filevec[])
 
   /* Set up tables of which lines are going to be discarded.  */
 
-  discarded[0] = zalloc (filevec[0].buffered_lines
-                         + filevec[1].buffered_lines);
+  discarded[0] = spare_ztake (SPARE_DISCARDS,
+                              (filevec[0].buffered_lines
+                               + filevec[1].buffered_lines), 1);
   discarded[1] = discarded[0] + filevec[0].buffered_lines;
 
   /* Mark to be discarded each line that matches no line of the other file.
@@ -229,20 +257,15 @@ discard_confusing_lines (struct file_data filevec[])
     {
       char *discards = discarded[f];
       lin end = filevec[f].buffered_lines;
-      lin j = 0;
       for (i = 0; i < end; ++i)
-        if (minimal || discards[i] == 0)
-          {
-            filevec[f].undiscarded[j] = filevec[f].equivs[i];
-            filevec[f].realindexes[j++] = i;
-          }
-        else
+        if (minimal)
+          discards[i] = 0;
+        else if (discards[i])
           filevec[f].changed[i] = 1;
-      filevec[f].nondiscarded_lines = j;
     }
 
-  free (discarded[0]);
-  free (equiv_count[0]);
+  spare_give (SPARE_COUNTS, equiv_count[0],
+              filevec[0].equiv_max * (2 * sizeof *p));
 }
 
 /* Adjust inserts/deletes of identical lines to join changes
@@ -352,7 +375,38 @@ shift_boundaries (struct file_data filevec[])
     }
 }
 
-/* Cons an additional entry onto the front of an edit script OLD.
+/* Return the number of changes in the edit script of the files of
+   FILEVEC, that is, of runs of inserted or deleted lines between lines
+   that match.  Scanning forward or backward finds the same runs.  */
+
+static lin _GL_ATTRIBUTE_PURE
+count_changes (struct file_data const filevec[])
+{
+  char *changed0 = filevec[0].changed;
+  char *changed1 = filevec[1].changed;
+  lin len0 = filevec[0].buffered_lines;
+  lin len1 = filevec[1].buffered_lines;
+  lin changes = 0;
+
+  /* Note that changedN[lenN] does exist, and is 0.  */
+
+  lin i0 = 0, i1 = 0;
+
+  while (i0 < len0 || i1 < len1)
+    {
+      if (changed0[i0] | changed1[i1])
+        {
+          while (changed0[i0]) ++i0;
+          while (changed1[i1]) ++i1;
+          changes++;
+        }
+      i0++, i1++;
+    }
+
+  return changes;
+}
+
+/* Fill in NEW as an additional entry at the front of an edit script OLD.
    LINE0 and LINE1 are the first affected lines in the two files (origin 0).
    DELETED is the number of lines deleted here from file 0.
    INSERTED is the number of lines inserted here in file 1.
@@ -361,11 +415,9 @@ shift_boundaries (struct file_data filevec[])
    which the insertion was done; vice versa for INSERTED and LINE1.  */
 
 static struct change *
-add_change (lin line0, lin line1, lin deleted, lin inserted,
-            struct change *old)
+add_change (struct change *new, lin line0, lin line1, lin deleted,
+            lin inserted, struct change *old)
 {
-  struct change *new = xmalloc (sizeof *new);
-
   new->line0 = line0;
   new->line1 = line1;
   new->inserted = inserted;
@@ -375,10 +427,11 @@ add_change (lin line0, lin line1, lin deleted, lin inserted,
 }
 
 /* Scan the tables of which lines are inserted and deleted,
-   producing an edit script in reverse order.  */
+   producing an edit script in reverse order in SPACE, which has room
+   for all its changes.  */
 
 static struct change *
-build_reverse_script (struct file_data const filevec[])
+build_reverse_script (struct file_data const filevec[], struct change *space)
 {
   struct change *script = 0;
   char *changed0 = filevec[0].changed;
@@ -401,7 +454,8 @@ build_reverse_script (struct file_data const filevec[])
           while (changed1[i1]) ++i1;
 
           /* Record this change.  */
-          script = add_change (line0, line1, i0 - line0, i1 - line1, script);
+          script = add_change (space++, line0, line1,
+                               i0 - line0, i1 - line1, script);
         }
 
       /* We have reached lines in the two files that match each other.  */
@@ -412,10 +466,11 @@ build_reverse_script (struct file_data const filevec[])
 }
 
 /* Scan the tables of which lines are inserted and deleted,
-   producing an edit script in forward order.  */
+   producing an edit script in forward order in SPACE, which has room
+   for all its changes.  */
 
 static struct change *
-build_script (struct file_data const filevec[])
+build_script (struct file_data const filevec[], struct change *space)
 {
   struct change *script = 0;
   char *changed0 = filevec[0].changed;
@@ -435,7 +490,8 @@ build_script (struct file_data const filevec[])
           while (changed1[i1 - 1]) --i1;
 
           /* Record this change.  */
-          script = add_change (i0, i1, line0 - i0, line1 - i1, script);
+          script = add_change (space++, i0, i1,
+                               line0 - i0, line1 - i1, script);
         }
 
       /* We have reached lines in the two files that match each other.  */
@@ -457,15 +513,199 @@ briefly_report (int changes, struct file_data const filevec[])
              file_label[1] ? file_label[1] : filevec[1].name);
 }
 
+/* Compare the lines of the files of CMP, which read_files or
+   read_window has put into equivalence classes, and output the
+   differences unless BRIEF.  Return 1 if the files differ in a way
+   that is not ignored, 0 otherwise.  */
+static int
+diff_lines (struct comparison *cmp)
+{
+  struct change *script, *space;
+  lin script_changes;
+  int changes;
+  int f;
+  char *discarded[2];
+
+  /* Allocate vectors for the results of comparison:
+     a flag for each line of each file, saying whether that line
+     is an insertion or deletion.
+     Allocate an extra element, always 0, at each end of each vector.  */
+
+  size_t s = cmp->file[0].buffered_lines + cmp->file[1].buffered_lines + 4;
+  char *flag_space = spare_ztake (SPARE_FLAGS, s, 1);
+  cmp->file[0].changed = flag_space + 1;
+  cmp->file[1].changed = flag_space + cmp->file[0].buffered_lines + 3;
+
+  /* Some lines are obviously insertions or deletions
+     because they don't match anything.  Detect them now, and
+     avoid even thinking about them in the main comparison algorithm.  */
+
+  discard_confusing_lines (cmp->file, discarded);
+
+  /* Now do the main comparison algorithm, considering just the
+     undiscarded lines.  Index them with 32 bits if they fit.  */
+
+  files[0] = cmp->file[0];
+  files[1] = cmp->file[1];
+  if (cmp->file[0].buffered_lines + cmp->file[1].buffered_lines
+      < INT32_MAX - 3
+      && cmp->file[0].equiv_max <= INT32_MAX)
+    compare_lines_32 (cmp->file, (char const *const *) discarded);
+  else
+    compare_lines (cmp->file, (char const *const *) discarded);
+  spare_give (SPARE_DISCARDS, discarded[0],
+              cmp->file[0].buffered_lines + cmp->file[1].buffered_lines);
+
+  /* Modify the results slightly to make them prettier
+     in cases where that can validly be done.  */
+
+  shift_boundaries (cmp->file);
+
+  /* Get the results of comparison in the form of a chain
+     of 'struct change's -- an edit script.  Allocate them all at once,
+     where the script of the previous comparison was.  */
+
+  script_changes = count_changes (cmp->file);
+  space = NULL;
+  if (script_changes)
+    space = spare_take (SPARE_SCRIPT, script_changes, sizeof *space);
+
+  if (output_style == OUTPUT_ED)
+    script = build_reverse_script (cmp->file, space);
+  else
+    script = build_script (cmp->file, space);
+
+  /* Set CHANGES if we had any diffs.
+     If some changes are ignored, we must scan the script to decide.  */
+  if (ignore_blank_lines || ignore_regexp.fastmap)
+    {
+      struct change *next = script;
+      changes = 0;
+
+      while (next && changes == 0)
+        {
+          struct change *this, *end;
+          lin first0, last0, first1, last1;
+
+          /* Find a set of changes that belong together.  */
+          this = next;
+          end = find_change (next);
+
+          /* Disconnect them from the rest of the changes, making them
+             a hunk, and remember the rest for next iteration.  */
+          next = end->link;
+          end->link = 0;
+
+          /* Determine whether this hunk is really a difference.  */
+          if (analyze_hunk (this, &first0, &last0, &first1, &last1))
+            changes = 1;
+
+          /* Reconnect the script so it will all be output.  */
+          end->link = next;
+        }
+    }
+  else
+    changes = (script != 0);
+
+  if (! brief && (changes || !no_diff_means_no_output))
+    switch (output_style)
+      {
+      case OUTPUT_CONTEXT:
+        print_context_script (script, false);
+        break;
+
+      case OUTPUT_UNIFIED:
+        print_context_script (script, true);
+        break;
+
+      case OUTPUT_ED:
+        print_ed_script (script);
+        break;
+
+      case OUTPUT_FORWARD_ED:
+        pr_forward_ed_script (script);
+        break;
+
+      case OUTPUT_RCS:
+        print_rcs_script (script);
+        break;
+
+      case OUTPUT_NORMAL:
+        print_normal_script (script);
+        break;
+
+      case OUTPUT_IFDEF:
+        print_ifdef_script (script);
+        break;
+
+      case OUTPUT_SDIFF:
+        print_sdiff_script (script);
+        break;
+
+      default:
+        abort ();
+      }
+
+  spare_give (SPARE_FLAGS, flag_space, s);
+  spare_give (SPARE_SCRIPT, space, script_changes * sizeof *space);
+
+  for (f = 0; f < 2; f++)
+    {
+      free (cmp->file[f].equivs);
+      free (cmp->file[f].linbuf + cmp->file[f].linbuf_base);
+    }
+
+  return changes;
+}
+
+/* The smallest window worth comparing with --max-memory, which is
+   also the size of the first window with --progressive.  */
+enum { WINDOW_SIZE_MIN = 64 * 1024 };
+
+/* The size that --progressive doubles windows up to, unless
+   --max-memory asks for smaller ones.  */
+enum { PROGRESSIVE_WINDOW_MAX = 16 * 1024 * 1024 };
+
+/* Return the size of the largest windows in which to compare files
+   with --max-memory or --progressive.  */
+static size_t
+window_size_max (void)
+{
+  /* The line tables and equivalence classes of a window typically take
+     somewhat more space than its text, and each file has a window.  */
+  return (max_memory
+          ? MAX (max_memory / 6, WINDOW_SIZE_MIN)
+          : PROGRESSIVE_WINDOW_MAX);
+}
+
+/* Return the size of the first window in which to compare the files
+   of CMP with --max-memory or --progressive, or 0 if they should be
+   compared whole.  */
+static size_t
+window_size (struct comparison const *cmp)
+{
+  size_t size = progressive ? WINDOW_SIZE_MIN : window_size_max ();
+  int f;
+
+  if (! (max_memory || progressive)
+      || output_style == OUTPUT_ED
+      || cmp->file[0].desc == cmp->file[1].desc)
+    return 0;
+  for (f = 0; f < 2; f++)
+    if (0 <= cmp->file[f].desc
+        && (! S_ISREG (cmp->file[f].stat.st_mode)
+            || size < cmp->file[f].stat.st_size))
+      return size;
+  return 0;
+}
+
 /* Report the differences of two files.  */
 int
 diff_2_files (struct comparison *cmp)
 {
   int f;
-  struct change *e, *p;
-  struct change *script;
   int changes;
-
+  size_t window = window_size (cmp);
 
   /* If we have detected that either file is binary,
      compare the two files as binary.  This can happen
@@ -473,7 +713,9 @@ diff_2_files (struct comparison *cmp)
      Also, --brief without any --ignore-* options means
      we can speed things up by treating the files as binary.  */
 
-  if (read_files (cmp->file, files_can_be_treated_as_binary))
+  if (window
+      ? start_windows (cmp->file, files_can_be_treated_as_binary, window)
+      : read_files (cmp->file, files_can_be_treated_as_binary))
     {
       /* Files with different lengths must be different.  */
       if (cmp->file[0].stat.st_size != cmp->file[1].stat.st_size
@@ -501,201 +743,148 @@ diff_2_files (struct comparison *cmp)
           for (f = 0; f < 2; f++)
             cmp->file[f].buffer = xrealloc (cmp->file[f].buffer, buffer_size);
 
+          /* With a digest cache, read both files to the end even if
+             they differ, so that their digests can be recorded.  */
+          struct digest_ctx digest[2];
+          bool digesting = (digest_cacheable (&cmp->file[0].stat)
+                            && digest_cacheable (&cmp->file[1].stat));
+          if (digesting)
+            for (f = 0; f < 2; f++)
+              digest_init (&digest[f]);
+
+          /* Regular files may have holes, which need not be read if
+             both files have them at the same offset.  */
+          struct hole_cursor cursor[2];
+          bool sparse = true;
+          for (f = 0; f < 2 && sparse; f++)
+            {
+              off_t pos = (S_ISREG (cmp->file[f].stat.st_mode)
+                           ? lseek (cmp->file[f].desc, 0, SEEK_CUR)
+                           : -1);
+              sparse = 0 <= pos;
+              hole_cursor_init (&cursor[f], cmp->file[f].desc, pos);
+            }
+
+          changes = 0;
           for (;; cmp->file[0].buffered = cmp->file[1].buffered = 0)
             {
+              if (sparse
+                  && ! cmp->file[0].buffered && ! cmp->file[1].buffered)
+                {
+                  off_t skipped = skip_common_holes (cursor,
+                                                     TYPE_MAXIMUM (off_t));
+                  if (skipped < 0)
+                    pfatal_with_name (cmp->file[cursor[1].pos < 0].name);
+
+                  /* Digesting the hole would mean hashing its zeros,
+                     which costs more than skipping it next time.  */
+                  if (skipped)
+                    {
+                      digesting = false;
+                      if (changes)
+                        break;
+                    }
+                }
+
               /* Read a buffer's worth from both files.  */
               for (f = 0; f < 2; f++)
                 if (0 <= cmp->file[f].desc)
-                  file_block_read (&cmp->file[f],
-                                   buffer_size - cmp->file[f].buffered);
+                  {
+                    size_t buffered = cmp->file[f].buffered;
+                    file_block_read (&cmp->file[f], buffer_size - buffered);
+                    if (sparse)
+                      cursor[f].pos += cmp->file[f].buffered - buffered;
+                  }
+              if (digesting)
+                for (f = 0; f < 2; f++)
+                  digest_update (&digest[f], cmp->file[f].buffer,
+                                 cmp->file[f].buffered);
 
               /* If the buffers differ, the files differ.  */
-              if (cmp->file[0].buffered != cmp->file[1].buffered
-                  || memcmp (cmp->file[0].buffer,
-                             cmp->file[1].buffer,
-                             cmp->file[0].buffered))
+              if (! changes
+                  && (cmp->file[0].buffered != cmp->file[1].buffered
+                      || memcmp (cmp->file[0].buffer,
+                                 cmp->file[1].buffer,
+                                 cmp->file[0].buffered)))
                 {
                   changes = 1;
-                  break;
+                  if (! digesting)
+                    break;
                 }
 
-              /* If we reach end of file, the files are the same.  */
-              if (cmp->file[0].buffered != buffer_size)
-                {
-                  changes = 0;
-                  break;
-                }
+              /* If we reach end of file, we are done.  */
+              if (cmp->file[0].buffered != buffer_size
+                  && cmp->file[1].buffered != buffer_size)
+                break;
             }
+
+          if (digesting)
+            for (f = 0; f < 2; f++)
+              {
+                unsigned char d[DIGEST_SIZE];
+                digest_finish (&digest[f], d);
+                record_digest (&cmp->file[f].stat, d);
+              }
         }
 
       briefly_report (changes, cmp->file);
     }
   else
     {
-      struct context ctxt;
-      lin diags;
-      lin too_expensive;
-
-      /* Allocate vectors for the results of comparison:
-         a flag for each line of each file, saying whether that line
-         is an insertion or deletion.
-         Allocate an extra element, always 0, at each end of each vector.  */
-
-      size_t s = cmp->file[0].buffered_lines + cmp->file[1].buffered_lines + 4;
-      char *flag_space = zalloc (s);
-      cmp->file[0].changed = flag_space + 1;
-      cmp->file[1].changed = flag_space + cmp->file[0].buffered_lines + 3;
-
-      /* Some lines are obviously insertions or deletions
-         because they don't match anything.  Detect them now, and
-         avoid even thinking about them in the main comparison algorithm.  */
-
-      discard_confusing_lines (cmp->file);
-
-      /* Now do the main comparison algorithm, considering just the
-         undiscarded lines.  */
-
-      ctxt.xvec = cmp->file[0].undiscarded;
-      ctxt.yvec = cmp->file[1].undiscarded;
-      diags = (cmp->file[0].nondiscarded_lines
-               + cmp->file[1].nondiscarded_lines + 3);
-      ctxt.fdiag = xmalloc (diags * (2 * sizeof *ctxt.fdiag));
-      ctxt.bdiag = ctxt.fdiag + diags;
-      ctxt.fdiag += cmp->file[1].nondiscarded_lines + 1;
-      ctxt.bdiag += cmp->file[1].nondiscarded_lines + 1;
-
-      ctxt.heuristic = speed_large_files;
-
-      /* Set TOO_EXPENSIVE to be the approximate square root of the
-         input size, bounded below by 4096.  4096 seems to be good for
-         circa-2016 CPUs; see Bug#16848 and Bug#24715.  */
-      too_expensive = 1;
-      for (;  diags != 0;  diags >>= 2)
-        too_expensive <<= 1;
-      ctxt.too_expensive = MAX (4096, too_expensive);
-
-      files[0] = cmp->file[0];
-      files[1] = cmp->file[1];
-
-      compareseq (0, cmp->file[0].nondiscarded_lines,
-                  0, cmp->file[1].nondiscarded_lines, minimal, &ctxt);
-
-      free (ctxt.fdiag - (cmp->file[1].nondiscarded_lines + 1));
-
-      /* Modify the results slightly to make them prettier
-         in cases where that can validly be done.  */
-
-      shift_boundaries (cmp->file);
-
-      /* Get the results of comparison in the form of a chain
-         of 'struct change's -- an edit script.  */
-
-      if (output_style == OUTPUT_ED)
-        script = build_reverse_script (cmp->file);
-      else
-        script = build_script (cmp->file);
-
-      /* Set CHANGES if we had any diffs.
-         If some changes are ignored, we must scan the script to decide.  */
-      if (ignore_blank_lines || ignore_regexp.fastmap)
+      /* Record info for starting up output,
+         to be used if and when we have some output to print.  */
+      if (! brief)
+        setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
+                      file_label[1] ? file_label[1] : cmp->file[1].name,
+                      cmp->parent != 0);
+
+      start_budget ();
+      if (window)
         {
-          struct change *next = script;
+          size_t window_max = window_size_max ();
           changes = 0;
-
-          while (next && changes == 0)
+          while (! (brief && changes) && ! hunk_limit_reached ()
+                 && read_window (cmp->file))
             {
-              struct change *this, *end;
-              lin first0, last0, first1, last1;
-
-              /* Find a set of changes that belong together.  */
-              this = next;
-              end = find_change (next);
+              changes |= diff_lines (cmp);
 
-              /* Disconnect them from the rest of the changes, making them
-                 a hunk, and remember the rest for next iteration.  */
-              next = end->link;
-              end->link = 0;
-
-              /* Determine whether this hunk is really a difference.  */
-              if (analyze_hunk (this, &first0, &last0, &first1, &last1))
-                changes = 1;
-
-              /* Reconnect the script so it will all be freed properly.  */
-              end->link = next;
+              /* With --progressive, show the differences found so far
+                 before reading on, and read more at a time as the
+                 comparison goes on.  */
+              if (progressive)
+                {
+                  if (outfile)
+                    fflush (outfile);
+                  if (window < window_max)
+                    {
+                      window = MIN (2 * window, window_max);
+                      grow_windows (cmp->file, window);
+                    }
+                }
             }
         }
       else
-        changes = (script != 0);
+        changes = diff_lines (cmp);
+      if (budget.level != WITHIN_BUDGET)
+        stats.comparisons_over_half_budget++;
+      if (budget.level == OVER_BUDGET)
+        stats.comparisons_over_budget++;
+
+      /* Warn that the differences may not be minimal, so that scripts
+         using the budget options can tell.  */
+      if (budget.level != WITHIN_BUDGET)
+        error (0, 0, (budget.level == OVER_BUDGET
+                      ? _("%s and %s: over budget;"
+                          " the differences may not be minimal")
+                      : _("%s and %s: over half the budget;"
+                          " the differences may not be minimal")),
+               file_label[0] ? file_label[0] : cmp->file[0].name,
+               file_label[1] ? file_label[1] : cmp->file[1].name);
 
       if (brief)
         briefly_report (changes, cmp->file);
       else
-        {
-          if (changes || !no_diff_means_no_output)
-            {
-              /* Record info for starting up output,
-                 to be used if and when we have some output to print.  */
-              setup_output (file_label[0] ? file_label[0] : cmp->file[0].name,
-                            file_label[1] ? file_label[1] : cmp->file[1].name,
-                            cmp->parent != 0);
-
-              switch (output_style)
-                {
-                case OUTPUT_CONTEXT:
-                  print_context_script (script, false);
-                  break;
-
-                case OUTPUT_UNIFIED:
-                  print_context_script (script, true);
-                  break;
-
-                case OUTPUT_ED:
-                  print_ed_script (script);
-                  break;
-
-                case OUTPUT_FORWARD_ED:
-                  pr_forward_ed_script (script);
-                  break;
-
-                case OUTPUT_RCS:
-                  print_rcs_script (script);
-                  break;
-
-                case OUTPUT_NORMAL:
-                  print_normal_script (script);
-                  break;
-
-                case OUTPUT_IFDEF:
-                  print_ifdef_script (script);
-                  break;
-
-                case OUTPUT_SDIFF:
-                  print_sdiff_script (script);
-                  break;
-
-                default:
-                  abort ();
-                }
-
-              finish_output ();
-            }
-        }
-
-      free (cmp->file[0].undiscarded);
-
-      free (flag_space);
-
-      for (f = 0; f < 2; f++)
-        {
-          free (cmp->file[f].equivs);
-          free (cmp->file[f].linbuf + cmp->file[f].linbuf_base);
-        }
-
-      for (e = script; e; e = p)
-        {
-          p = e->link;
-          free (e);
-        }
+        finish_output ();
 
       if (! ROBUST_OUTPUT_STYLE (output_style))
         for (f = 0; f < 2; ++f)
@@ -708,9 +897,7 @@ diff_2_files (struct comparison *cmp)
             }
     }
 
-  if (cmp->file[0].buffer != cmp->file[1].buffer)
-    free (cmp->file[0].buffer);
-  free (cmp->file[1].buffer);
+  release_buffers (cmp->file);
 
   return changes;
 }
@@ -391,6 +391,9 @@ cmp (void)
   int differing = 0;
   int f;
   int offset_width IF_LINT (= 0);
+  struct hole_cursor cursor[2];
+  bool sparse = (S_ISREG (stat_buf[0].st_mode)
+                 && S_ISREG (stat_buf[1].st_mode));
 
   if (comparison_type == type_all_diffs)
     {
@@ -431,10 +434,35 @@ cmp (void)
         }
     }
 
+  /* Regular files may have holes, which need not be read if both
+     files have them at the same offset.  */
+  for (f = 0; f < 2 && sparse; f++)
+    {
+      off_t pos = file_position (f);
+      sparse = 0 <= pos;
+      hole_cursor_init (&cursor[f], file_desc[f], pos);
+    }
+
   do
     {
       size_t bytes_to_read = buf_size;
 
+      if (sparse)
+        {
+          off_t limit = (0 <= remaining && remaining < TYPE_MAXIMUM (off_t)
+                         ? remaining : TYPE_MAXIMUM (off_t));
+          off_t skipped = skip_common_holes (cursor, limit);
+          if (skipped < 0)
+            die (EXIT_TROUBLE, errno, "%s", file[cursor[1].pos < 0]);
+          if (skipped)
+            {
+              byte_number += skipped;
+              at_line_start = false;
+              if (0 <= remaining)
+                remaining -= skipped;
+            }
+        }
+
       if (0 <= remaining)
         {
           if (remaining < bytes_to_read)
@@ -448,6 +476,11 @@ cmp (void)
       read1 = block_read (file_desc[1], buf1, bytes_to_read);
       if (read1 == SIZE_MAX)
         die (EXIT_TROUBLE, errno, "%s", file[1]);
+      if (sparse)
+        {
+          cursor[0].pos += read0;
+          cursor[1].pos += read1;
+        }
 
       smaller = MIN (read0, read1);
 
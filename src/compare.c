@@ -0,0 +1,818 @@
+/* Find the changed lines of two files for GNU DIFF.
+
+   Copyright (C) 1988-1989, 1992-1995, 1998, 2001-2002, 2004, 2006-2007,
+   2009-2013, 2015-2021 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This file compares the lines of two files that discard_confusing_lines
+   left, and marks the lines that changed.  It is compiled twice: as is,
+   with line indexes and equivalence classes of type lin in its vectors,
+   and by compare32.c, with them of type int32_t, for files with few
+   enough lines.  That halves the memory that the comparison reads and
+   writes, which is most of its work on files with many changes.  */
+
+#include "diff.h"
+#include <xalloc.h>
+
+#include <stdint.h>
+
+#ifdef COMPARE_32
+# define IDX int32_t
+# define compare_lines compare_lines_32
+#else
+# define IDX lin
+#endif
+
+struct context;
+static bool charge_cost (struct context *, intmax_t);
+static bool solve_subproblem (struct context *, lin, lin, lin, lin);
+
+#if USE_POSIX_THREADS
+# include <pthread.h>
+
+struct compare_pool;
+static bool spawn_subproblem (struct context *, lin, lin, lin, lin, bool);
+#endif
+
+/* For each file being compared, the index of each of its lines that
+   discard_confusing_lines did not discard.  */
+static IDX *realindexes[2];
+
+/* Mark line OFF of file F as changed, given its index among the
+   lines that were not discarded.  */
+#define NOTE_CHANGE(f, off) (files[f].changed[realindexes[f][off]] = 1)
+
+/* The core of the Diff algorithm.  */
+#define ELEMENT IDX
+#define EQUAL(x,y) ((x) == (y))
+#define OFFSET IDX
+#define COMMON_CONTEXT_FIELDS \
+  IDX *classmap; intmax_t cost_left; enum budget_level budget_level;
+#if USE_POSIX_THREADS
+# define EXTRA_CONTEXT_FIELDS COMMON_CONTEXT_FIELDS struct compare_pool *pool;
+# define SPAWN_SUBPROBLEM(c, xoff, xlim, yoff, ylim, find_minimal) \
+   ((c)->pool && spawn_subproblem (c, xoff, xlim, yoff, ylim, find_minimal))
+#else
+# define EXTRA_CONTEXT_FIELDS COMMON_CONTEXT_FIELDS
+#endif
+#define CHARGE_COST(c, cost) charge_cost (c, cost)
+#define SOLVE_SUBPROBLEM(c, xoff, xlim, yoff, ylim) \
+   solve_subproblem (c, xoff, xlim, yoff, ylim)
+#define NOTE_DELETE(c, xoff) NOTE_CHANGE (0, xoff)
+#define NOTE_INSERT(c, yoff) NOTE_CHANGE (1, yoff)
+#define USE_HEURISTIC 1
+#include <diffseq.h>
+
+/* Set up CTXT for comparing lines XOFF through XLIM - 1 of the first
+   file with lines YOFF through YLIM - 1 of the second, allocating
+   FDIAG and BDIAG for just the diagonals that the comparison visits,
+   from the SPARE_DIAGS block if SPARE.  Free them, and any class map
+   that dense_lcs allocated, with free_diags.  */
+
+static void
+alloc_diags (struct context *ctxt, lin xoff, lin xlim, lin yoff, lin ylim,
+             bool spare)
+{
+  lin diags = (xlim - xoff) + (ylim - yoff) + 3;
+  ctxt->fdiag = (spare
+                 ? spare_take (SPARE_DIAGS, diags, 2 * sizeof *ctxt->fdiag)
+                 : xnmalloc (diags, 2 * sizeof *ctxt->fdiag));
+  ctxt->bdiag = ctxt->fdiag + diags;
+  ctxt->fdiag += ylim - xoff + 1;
+  ctxt->bdiag += ylim - xoff + 1;
+  ctxt->classmap = NULL;
+}
+
+static void
+free_diags (struct context *ctxt, lin xoff, lin xlim, lin yoff, lin ylim,
+            bool spare)
+{
+  lin diags = (xlim - xoff) + (ylim - yoff) + 3;
+  IDX *fdiag = ctxt->fdiag - (ylim - xoff + 1);
+  if (spare)
+    spare_give (SPARE_DIAGS, fdiag, diags * (2 * sizeof *fdiag));
+  else
+    free (fdiag);
+  free (ctxt->classmap);
+}
+
+/* Bit-parallel LCS.  When most lines of a subproblem changed, diag
+   visits nearly every point of the edit matrix, one diagonal at a time.
+   Instead, compute the rows of the LCS matrix 64 columns at a time, as
+   in Hyyro's variant of the Allison-Dix algorithm: bit I of V is clear
+   exactly where the LCS of the second file's lines so far with the
+   first file's first I + 1 lines exceeds that with the first I lines,
+   and each line of the second file updates V with one addition and a
+   few logical operations.  The rows are computed over the lines in
+   reverse, so that keeping every row's V lets a walk forward from the
+   start find a longest common subsequence, and so a minimal edit
+   script, that matches lines as early as compareseq's snakes do.  */
+
+typedef uint64_t lcs_word;
+enum { LCS_WORD_BITS = 64 };
+
+/* Subproblems with more than this many points in their edit matrix are
+   left to diag, to bound the memory for the rows.  */
+enum { LCS_MAX_CELLS = 1 << 22 };
+
+/* Subproblems with fewer lines than this in either file are left to
+   diag, which is fast on them anyway.  */
+enum { LCS_MIN_LINES = 256 };
+
+/* If it looks worthwhile, find a minimal edit script for lines XOFF
+   through XLIM - 1 of the first file and YOFF through YLIM - 1 of the
+   second with bit-parallel LCS, and return true.  Otherwise return
+   false.  */
+
+static bool
+dense_lcs (struct context *ctxt, lin xoff, lin xlim, lin yoff, lin ylim)
+{
+  IDX const *xv = ctxt->xvec;
+  IDX const *yv = ctxt->yvec;
+  lin n = xlim - xoff, m = ylim - yoff;
+  lin i, j;
+
+  if (n < LCS_MIN_LINES || m < LCS_MIN_LINES || LCS_MAX_CELLS / n < m)
+    return false;
+
+  /* Estimate the edit distance from below: no more lines can match
+     than the lines of each class that both files have.  */
+  IDX *classmap = ctxt->classmap;
+  if (!classmap)
+    classmap = ctxt->classmap = xcalloc (files[0].equiv_max,
+                                         sizeof *classmap);
+  lin common = 0;
+  for (i = xoff; i < xlim; i++)
+    classmap[xv[i]]++;
+  for (j = yoff; j < ylim; j++)
+    if (classmap[yv[j]])
+      {
+        classmap[yv[j]]--;
+        common++;
+      }
+  for (i = xoff; i < xlim; i++)
+    classmap[xv[i]] = 0;
+
+  /* diag costs roughly the number of lines times the edit distance,
+     and this algorithm a few operations per word of the matrix.
+     Charge the words to the budget as diagonals that diag searched.  */
+  lin words = (n + LCS_WORD_BITS - 1) / LCS_WORD_BITS;
+  lin distance = n + m - 2 * common;
+  if (distance * (n + m) < 8 * words * m || charge_cost (ctxt, words * m))
+    return false;
+
+  /* Make a mask of the first file's lines in each class, last line
+     first, numbering the classes in the subproblem from 1 in CLASSMAP.
+     Mask 0 is empty.  */
+  lin classes = 0;
+  for (i = xoff; i < xlim; i++)
+    if (!classmap[xv[i]])
+      classmap[xv[i]] = ++classes;
+  lcs_word *mask = xcalloc ((classes + 1) * words, sizeof *mask);
+  for (i = 0; i < n; i++)
+    mask[classmap[xv[xlim - 1 - i]] * words + i / LCS_WORD_BITS]
+      |= (lcs_word) 1 << (i % LCS_WORD_BITS);
+
+  /* Compute the rows.  Row J is V after the last J lines of the second
+     file.  */
+  lcs_word *row = xnmalloc ((m + 1) * words, sizeof *row);
+  for (i = 0; i < words; i++)
+    row[i] = -1;
+  for (j = 0; j < m; j++)
+    {
+      lcs_word const *v = row + j * words;
+      lcs_word *w = row + (j + 1) * words;
+      lcs_word const *pm = mask + classmap[yv[ylim - 1 - j]] * words;
+      lcs_word carry = 0;
+      for (i = 0; i < words; i++)
+        {
+          lcs_word u = v[i] & pm[i];
+          lcs_word sum = v[i] + u;
+          lcs_word sum1 = sum + carry;
+          carry = (sum < u) | (sum1 < sum);
+          w[i] = sum1 | (v[i] & ~u);
+        }
+    }
+
+  for (i = xoff; i < xlim; i++)
+    classmap[xv[i]] = 0;
+  free (mask);
+
+  /* Walk forward from the start, with I and J the numbers of lines
+     left in each file, matching lines where possible.  Where the lines
+     differ, the LCS of the lines left does not grow at column I of
+     row J exactly when bit I - 1 of row J is set, and then the first
+     file's line can be deleted without making the LCS shorter.  */
+  for (i = n, j = m; 0 < i && 0 < j; )
+    if (xv[xlim - i] == yv[ylim - j])
+      i--, j--;
+    else if (row[j * words + (i - 1) / LCS_WORD_BITS]
+             >> ((i - 1) % LCS_WORD_BITS) & 1)
+      NOTE_CHANGE (0, xlim - i--);
+    else
+      NOTE_CHANGE (1, ylim - j--);
+  while (0 < i)
+    NOTE_CHANGE (0, xlim - i--);
+  while (0 < j)
+    NOTE_CHANGE (1, ylim - j--);
+
+  free (row);
+  return true;
+}
+
+#if USE_POSIX_THREADS
+/* With --threads, subproblems of compareseq with at least this many
+   lines in all are worth handing to another thread.  */
+enum { PARALLEL_MIN_SUBPROBLEM = 1 << 12 };
+
+/* A subproblem of compareseq waiting for a thread.  */
+struct compare_task
+{
+  lin xoff, xlim, yoff, ylim;
+  bool find_minimal;
+};
+
+/* Threads that solve subproblems of compareseq.  A thread that splits
+   a problem offers one half to the pool only if some thread is idle,
+   so that tasks are made only when there is a thread to take them,
+   and otherwise recurses as usual.  */
+struct compare_pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t change;        /* Tasks were added, or all are done.  */
+  struct compare_task *tasks;   /* Stack of waiting tasks.  */
+  size_t ntasks;
+  size_t tasks_alloc;
+  int idle;                     /* Threads waiting for a task.  */
+  int running;                  /* Tasks being solved.  */
+  struct context const *proto;  /* What the tasks' contexts share.  */
+};
+
+static bool
+spawn_subproblem (struct context *ctxt, lin xoff, lin xlim,
+                  lin yoff, lin ylim, bool find_minimal)
+{
+  struct compare_pool *pool = ctxt->pool;
+  bool spawned = false;
+
+  if ((xlim - xoff) + (ylim - yoff) < PARALLEL_MIN_SUBPROBLEM)
+    return false;
+
+  pthread_mutex_lock (&pool->lock);
+  if (pool->ntasks < pool->idle)
+    {
+      if (pool->ntasks == pool->tasks_alloc)
+        pool->tasks = x2nrealloc (pool->tasks, &pool->tasks_alloc,
+                                  sizeof *pool->tasks);
+      struct compare_task *t = &pool->tasks[pool->ntasks++];
+      t->xoff = xoff;
+      t->xlim = xlim;
+      t->yoff = yoff;
+      t->ylim = ylim;
+      t->find_minimal = find_minimal;
+      stats.subproblems_spawned++;
+      pthread_cond_signal (&pool->change);
+      spawned = true;
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return spawned;
+}
+
+/* Solve tasks from the pool POOL until all are done.  */
+
+static void *
+solve_subproblems (void *arg)
+{
+  struct compare_pool *pool = *(struct compare_pool **) arg;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (! pool->ntasks && pool->running)
+        {
+          pool->idle++;
+          pthread_cond_wait (&pool->change, &pool->lock);
+          pool->idle--;
+        }
+      if (! pool->ntasks)
+        break;
+
+      struct compare_task t = pool->tasks[--pool->ntasks];
+      pool->running++;
+      pthread_mutex_unlock (&pool->lock);
+
+      struct context ctxt = *pool->proto;
+      alloc_diags (&ctxt, t.xoff, t.xlim, t.yoff, t.ylim, false);
+      compareseq (t.xoff, t.xlim, t.yoff, t.ylim, t.find_minimal, &ctxt);
+      free_diags (&ctxt, t.xoff, t.xlim, t.yoff, t.ylim, false);
+
+      pthread_mutex_lock (&pool->lock);
+      if (! --pool->running && ! pool->ntasks)
+        pthread_cond_broadcast (&pool->change);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* Like compareseq on all the lines of CTXT's files, but with THREADS
+   threads solving independent subproblems at the same time.  */
+
+static void
+compareseq_in_parallel (lin xlim, lin ylim, bool find_minimal,
+                        struct context *ctxt)
+{
+  struct compare_pool pool;
+  struct compare_pool **arg = xnmalloc (threads, sizeof *arg);
+  int i;
+
+  pthread_mutex_init (&pool.lock, NULL);
+  pthread_cond_init (&pool.change, NULL);
+  pool.tasks_alloc = threads;
+  pool.tasks = xnmalloc (pool.tasks_alloc, sizeof *pool.tasks);
+  pool.tasks[0].xoff = 0;
+  pool.tasks[0].xlim = xlim;
+  pool.tasks[0].yoff = 0;
+  pool.tasks[0].ylim = ylim;
+  pool.tasks[0].find_minimal = find_minimal;
+  pool.ntasks = 1;
+  pool.idle = 0;
+  pool.running = 0;
+  ctxt->pool = &pool;
+  pool.proto = ctxt;
+  for (i = 0; i < threads; i++)
+    arg[i] = &pool;
+
+  run_threads (solve_subproblems, arg, sizeof *arg, threads);
+
+  free (arg);
+  free (pool.tasks);
+  pthread_cond_destroy (&pool.change);
+  pthread_mutex_destroy (&pool.lock);
+}
+#endif
+
+/* At most how many diagonals a context searches between checks of the
+   budget.  */
+enum { BUDGET_CHECK_COST = 1 << 14 };
+
+/* Return how many diagonals a context searches between checks of the
+   budget.  */
+
+static intmax_t
+budget_check_cost (void)
+{
+  return (cost_budget
+          ? MIN (BUDGET_CHECK_COST, cost_budget / 8 + 1)
+          : BUDGET_CHECK_COST);
+}
+
+/* Set CTXT to charge its search to the budget, if there is one.  */
+
+static void
+init_budget (struct context *ctxt)
+{
+  ctxt->cost_left = (cost_budget || time_budget
+                     ? budget_check_cost () : INTMAX_MAX);
+  ctxt->budget_level = spend_budget (0);
+}
+
+/* Add the diagonals that CTXT searched since it last checked the
+   budget to those spent, and return true if the comparison is now
+   over half its budget.  */
+
+static bool
+check_budget (struct context *ctxt)
+{
+#if USE_POSIX_THREADS
+  if (ctxt->pool)
+    pthread_mutex_lock (&ctxt->pool->lock);
+#endif
+
+  intmax_t check_cost = budget_check_cost ();
+  ctxt->budget_level = spend_budget (check_cost - ctxt->cost_left);
+  ctxt->cost_left = check_cost;
+
+#if USE_POSIX_THREADS
+  if (ctxt->pool)
+    pthread_mutex_unlock (&ctxt->pool->lock);
+#endif
+  return ctxt->budget_level != WITHIN_BUDGET;
+}
+
+/* Charge COST diagonals that CTXT searched to the budget, and return
+   true if the comparison is over half its budget.  */
+
+static inline bool
+charge_cost (struct context *ctxt, intmax_t cost)
+{
+  ctxt->cost_left -= cost;
+  return (ctxt->cost_left < 0
+          ? check_budget (ctxt)
+          : ctxt->budget_level != WITHIN_BUDGET);
+}
+
+/* Find an edit script for lines XOFF through XLIM - 1 of the first
+   file and YOFF through YLIM - 1 of the second other than by dividing
+   them, if the budget or their changes call for it, and return true
+   if that was done.  */
+
+static bool
+solve_subproblem (struct context *ctxt, lin xoff, lin xlim,
+                  lin yoff, lin ylim)
+{
+  switch (ctxt->budget_level)
+    {
+    case WITHIN_BUDGET:
+      return dense_lcs (ctxt, xoff, xlim, yoff, ylim);
+
+    case OVER_HALF_BUDGET:
+      return false;
+
+    default:
+      for (; xoff < xlim; xoff++)
+        NOTE_CHANGE (0, xoff);
+      for (; yoff < ylim; yoff++)
+        NOTE_CHANGE (1, yoff);
+      return true;
+    }
+}
+
+/* Patience diff (--algorithm=patience).  Lines that occur exactly once
+   in both files are likely to correspond, so match the longest
+   sequence of such lines that is in the same order in both files,
+   recursively between each pair of matched lines, and leave what
+   contains no such lines to compareseq.  This finds changes that
+   line up with the unique lines, such as whole functions, where
+   compareseq might match braces and blank lines instead.  */
+
+/* Nesting of gaps between matched unique lines beyond which
+   patience_diff leaves the gap to compareseq.  */
+enum { PATIENCE_MAX_DEPTH = 64 };
+
+struct patience
+{
+  /* The comparison's context, for compareseq.  */
+  struct context *ctxt;
+
+  /* For each equivalence class, how many times (at most 2) it occurs in
+     each file's part of the region being examined, and where it last
+     occurs in the second file's part.  All zero between regions.  */
+  unsigned char *count[2];
+  IDX *ypos;
+};
+
+/* A pair of lines, one in each file, in the same equivalence class.  */
+struct line_pair
+{
+  IDX x, y;
+};
+
+/* Compare lines XOFF through XLIM - 1 of the first file with lines YOFF
+   through YLIM - 1 of the second with patience diff, using P.  DEPTH
+   is the nesting of this region in others.  Pass FIND_MINIMAL to
+   compareseq.  */
+
+static void
+patience_diff (lin xoff, lin xlim, lin yoff, lin ylim, bool find_minimal,
+               struct patience *p, int depth)
+{
+  IDX const *xv = p->ctxt->xvec;
+  IDX const *yv = p->ctxt->yvec;
+  lin i, n, k;
+
+  while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+    xoff++, yoff++;
+  while (xoff < xlim && yoff < ylim && xv[xlim - 1] == yv[ylim - 1])
+    xlim--, ylim--;
+
+  /* Find the lines that occur once in each file's part of the region,
+     in the order of the first file.  */
+  struct line_pair *pair = NULL;
+  n = 0;
+  if (xoff < xlim && yoff < ylim && depth < PATIENCE_MAX_DEPTH)
+    {
+      for (i = xoff; i < xlim; i++)
+        p->count[0][xv[i]] += p->count[0][xv[i]] < 2;
+      for (i = yoff; i < ylim; i++)
+        {
+          p->count[1][yv[i]] += p->count[1][yv[i]] < 2;
+          p->ypos[yv[i]] = i;
+        }
+      for (i = xoff; i < xlim; i++)
+        n += p->count[0][xv[i]] == 1 && p->count[1][xv[i]] == 1;
+      if (n)
+        {
+          pair = xnmalloc (n, sizeof *pair);
+          n = 0;
+          for (i = xoff; i < xlim; i++)
+            if (p->count[0][xv[i]] == 1 && p->count[1][xv[i]] == 1)
+              {
+                pair[n].x = i;
+                pair[n].y = p->ypos[xv[i]];
+                n++;
+              }
+        }
+      for (i = xoff; i < xlim; i++)
+        p->count[0][xv[i]] = 0;
+      for (i = yoff; i < ylim; i++)
+        p->count[1][yv[i]] = 0;
+    }
+
+  if (!n)
+    {
+      compareseq (xoff, xlim, yoff, ylim, find_minimal, p->ctxt);
+      return;
+    }
+
+  /* Find the longest subsequence of PAIR whose lines in the second
+     file are in increasing order, by patience sorting: TAIL[K] is the
+     pair that ends the best subsequence of length K + 1 found so far,
+     and PREV[I] the pair before pair I in the best subsequence that
+     ends with it.  */
+  lin *tail = xnmalloc (n, 2 * sizeof *tail);
+  lin *prev = tail + n;
+  lin len = 0;
+  for (i = 0; i < n; i++)
+    {
+      lin lo = 0, hi = len;
+      while (lo < hi)
+        {
+          lin mid = lo + (hi - lo) / 2;
+          if (pair[tail[mid]].y < pair[i].y)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      prev[i] = lo ? tail[lo - 1] : -1;
+      tail[lo] = i;
+      len += lo == len;
+    }
+
+  /* Gather the subsequence in order.  */
+  struct line_pair *anchor = xnmalloc (len, sizeof *anchor);
+  for (i = tail[len - 1], k = len; 0 <= i; i = prev[i])
+    anchor[--k] = pair[i];
+  free (tail);
+  free (pair);
+
+  /* The matched lines are unchanged; compare the gaps between them.  */
+  for (k = 0; k < len; k++)
+    {
+      patience_diff (xoff, anchor[k].x, yoff, anchor[k].y, find_minimal,
+                     p, depth + 1);
+      xoff = anchor[k].x + 1;
+      yoff = anchor[k].y + 1;
+    }
+  free (anchor);
+  patience_diff (xoff, xlim, yoff, ylim, find_minimal, p, depth + 1);
+}
+
+/* Histogram diff (--algorithm=histogram), as in JGit and Git.  Split
+   each region at the run of matching lines whose rarest line occurs
+   least often in the first file's part of the region, and compare the
+   parts before and after the run the same way.  This is like patience
+   diff, but also finds anchors among lines that are merely rare.
+   Lines of a region that occur more than HISTOGRAM_MAX_CHAIN times
+   are not tried as anchors, and if no other lines match, compareseq
+   compares the region instead.  */
+
+enum { HISTOGRAM_MAX_CHAIN = 64 };
+
+struct histogram
+{
+  /* The comparison's context, for compareseq.  */
+  struct context *ctxt;
+
+  /* For each equivalence class, how many times it occurs in the first
+     file's part of the region being examined (all zero between
+     regions), and where it first occurs there.  */
+  IDX *count;
+  IDX *head;
+
+  /* For each line of the first file, where the next line of its
+     equivalence class in the region is, or -1.  */
+  IDX *next;
+};
+
+/* Compare lines XOFF through XLIM - 1 of the first file with lines YOFF
+   through YLIM - 1 of the second with histogram diff, using H.  Pass
+   FIND_MINIMAL to compareseq.  */
+
+static void
+histogram_diff (lin xoff, lin xlim, lin yoff, lin ylim, bool find_minimal,
+                struct histogram *h)
+{
+  IDX const *xv = h->ctxt->xvec;
+  IDX const *yv = h->ctxt->yvec;
+
+  while (true)
+    {
+      lin i, j;
+
+      while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+        xoff++, yoff++;
+      while (xoff < xlim && yoff < ylim && xv[xlim - 1] == yv[ylim - 1])
+        xlim--, ylim--;
+      if (xoff == xlim || yoff == ylim)
+        {
+          compareseq (xoff, xlim, yoff, ylim, find_minimal, h->ctxt);
+          return;
+        }
+
+      /* Make the histogram of the first file's part, chaining each
+         class's lines in order.  */
+      for (i = xlim; xoff < i--; )
+        {
+          lin c = xv[i];
+          h->next[i] = h->count[c]++ ? h->head[c] : -1;
+          h->head[c] = i;
+        }
+
+      /* Try the lines of the second file's part, in order, as the
+         start of a run.  The best run so far is [BXOFF, BXLIM) in the
+         first file and starts at BYOFF in the second, and its rarest
+         line occurs BCOUNT times.  */
+      lin bxoff = 0, bxlim = 0, byoff = 0;
+      lin bcount = HISTOGRAM_MAX_CHAIN;
+      bool common = false;
+      for (j = yoff; j < ylim; )
+        {
+          lin jnext = j + 1;
+          lin c = yv[j];
+          common |= h->count[c] != 0;
+          if (h->count[c] && h->count[c] <= bcount)
+            for (i = h->head[c]; 0 <= i; i = h->next[i])
+              {
+                /* Extend the match at (I, J) both ways to a run,
+                   finding the count of its rarest line.  */
+                lin rxoff = i, rxlim = i + 1, ryoff = j, rylim = j + 1;
+                lin rcount = h->count[c];
+                while (xoff < rxoff && yoff < ryoff
+                       && xv[rxoff - 1] == yv[ryoff - 1])
+                  {
+                    rxoff--, ryoff--;
+                    rcount = MIN (rcount, h->count[xv[rxoff]]);
+                  }
+                while (rxlim < xlim && rylim < ylim
+                       && xv[rxlim] == yv[rylim])
+                  {
+                    rcount = MIN (rcount, h->count[xv[rxlim]]);
+                    rxlim++, rylim++;
+                  }
+
+                /* Prefer rarer runs, then longer ones.  */
+                if (rcount < bcount
+                    || (rcount == bcount && bxlim - bxoff < rxlim - rxoff))
+                  {
+                    bxoff = rxoff;
+                    bxlim = rxlim;
+                    byoff = ryoff;
+                    bcount = rcount;
+                  }
+
+                /* The lines of the second file in the run cannot start
+                   a better one.  */
+                jnext = MAX (jnext, rylim);
+              }
+          j = jnext;
+        }
+
+      for (i = xoff; i < xlim; i++)
+        h->count[xv[i]] = 0;
+
+      if (bxoff == bxlim)
+        {
+          if (common)
+            compareseq (xoff, xlim, yoff, ylim, find_minimal, h->ctxt);
+          else
+            {
+              /* No line matches, so all lines changed.  */
+              compareseq (xoff, xlim, yoff, yoff, find_minimal, h->ctxt);
+              compareseq (xlim, xlim, yoff, ylim, find_minimal, h->ctxt);
+            }
+          return;
+        }
+
+      /* Recurse to compare the smaller part on one side of the run,
+         and iterate to compare the other.  */
+      lin bylim = byoff + (bxlim - bxoff);
+      if (bxoff - xoff + byoff - yoff < xlim - bxlim + ylim - bylim)
+        {
+          histogram_diff (xoff, bxoff, yoff, byoff, find_minimal, h);
+          xoff = bxlim;
+          yoff = bylim;
+        }
+      else
+        {
+          histogram_diff (bxlim, xlim, bylim, ylim, find_minimal, h);
+          xlim = bxoff;
+          ylim = byoff;
+        }
+    }
+}
+
+/* Compare the lines of the files of FILEVEC that discard_confusing_lines
+   did not discard, as recorded in DISCARDED, and mark the lines that
+   changed.  */
+
+void
+compare_lines (struct file_data filevec[], char const *const discarded[2])
+{
+  struct context ctxt;
+  IDX *undiscarded[2];
+  lin lines[2];
+  lin diags;
+  lin too_expensive;
+  lin xlim, ylim;
+  int f;
+
+  lin buffered_lines = filevec[0].buffered_lines + filevec[1].buffered_lines;
+  IDX *p = spare_take (SPARE_INDEXES, buffered_lines, 2 * sizeof *p);
+  for (f = 0; f < 2; f++)
+    {
+      char const *discards = discarded[f];
+      lin end = filevec[f].buffered_lines;
+      lin i, j = 0;
+      undiscarded[f] = p;  p += end;
+      realindexes[f] = p;  p += end;
+      for (i = 0; i < end; i++)
+        if (! discards[i])
+          {
+            undiscarded[f][j] = filevec[f].equivs[i];
+            realindexes[f][j++] = i;
+          }
+      lines[f] = j;
+    }
+
+  xlim = lines[0];
+  ylim = lines[1];
+  ctxt.xvec = undiscarded[0];
+  ctxt.yvec = undiscarded[1];
+  diags = xlim + ylim + 3;
+  ctxt.heuristic = speed_large_files;
+
+  /* Set TOO_EXPENSIVE to be the approximate square root of the
+     input size, bounded below by 4096.  4096 seems to be good for
+     circa-2016 CPUs; see Bug#16848 and Bug#24715.  */
+  too_expensive = 1;
+  for (;  diags != 0;  diags >>= 2)
+    too_expensive <<= 1;
+  ctxt.too_expensive = MAX (4096, too_expensive);
+  init_budget (&ctxt);
+
+#if USE_POSIX_THREADS
+  ctxt.pool = NULL;
+  if (diff_algorithm == ALGORITHM_MYERS
+      && 1 < threads && 2 * PARALLEL_MIN_SUBPROBLEM <= xlim + ylim)
+    compareseq_in_parallel (xlim, ylim, minimal, &ctxt);
+  else
+#endif
+    {
+      alloc_diags (&ctxt, 0, xlim, 0, ylim, true);
+      if (diff_algorithm == ALGORITHM_PATIENCE)
+        {
+          struct patience pt;
+          lin classes = filevec[0].equiv_max;
+          pt.ctxt = &ctxt;
+          pt.count[0] = zalloc (2 * classes);
+          pt.count[1] = pt.count[0] + classes;
+          pt.ypos = xnmalloc (classes, sizeof *pt.ypos);
+          patience_diff (0, xlim, 0, ylim, minimal, &pt, 0);
+          free (pt.ypos);
+          free (pt.count[0]);
+        }
+      else if (diff_algorithm == ALGORITHM_HISTOGRAM)
+        {
+          struct histogram h;
+          lin classes = filevec[0].equiv_max;
+          h.ctxt = &ctxt;
+          h.count = xcalloc (classes, sizeof *h.count);
+          h.head = xnmalloc (classes, sizeof *h.head);
+          h.next = xnmalloc (xlim, sizeof *h.next);
+          histogram_diff (0, xlim, 0, ylim, minimal, &h);
+          free (h.next);
+          free (h.head);
+          free (h.count);
+        }
+      else
+        compareseq (0, xlim, 0, ylim, minimal, &ctxt);
+      free_diags (&ctxt, 0, xlim, 0, ylim, true);
+    }
+
+  spare_give (SPARE_INDEXES, undiscarded[0],
+              buffered_lines * (2 * sizeof *undiscarded[0]));
+}
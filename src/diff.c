@@ -42,6 +42,7 @@
 #include <xalloc.h>
 #include <xreadlink.h>
 #include <xstdopen.h>
+#include <xstrtol.h>
 #include <binary-io.h>
 
 /* The official name of this program (e.g., no 'g' prefix).  */
@@ -78,6 +79,8 @@ static void specify_value(char const **, char const *, char const *);
 
 static void specify_colors_style(char const *);
 
+static void specify_algorithm(char const *);
+
 static void try_help(char const *, char const *) __attribute__((noreturn));
 
 static void check_stdout(void);
@@ -118,7 +121,10 @@ static char const shortopts[] =
 
 /* Values for long options that do not have single-letter equivalents.  */
 enum {
-    BINARY_OPTION = CHAR_MAX + 1,
+    ALGORITHM_OPTION = CHAR_MAX + 1,
+    BINARY_OPTION,
+    COST_BUDGET_OPTION,
+    DIGEST_CACHE_OPTION,
     FROM_FILE_OPTION,
     HELP_OPTION,
     HORIZON_LINES_OPTION,
@@ -126,14 +132,20 @@ enum {
     INHIBIT_HUNK_MERGE_OPTION,
     LEFT_COLUMN_OPTION,
     LINE_FORMAT_OPTION,
+    MAX_HUNKS_OPTION,
+    MAX_MEMORY_OPTION,
     NO_DEREFERENCE_OPTION,
     NO_IGNORE_FILE_NAME_CASE_OPTION,
     NORMAL_OPTION,
+    PREFETCH_OPTION,
+    PROGRESSIVE_OPTION,
     SDIFF_MERGE_ASSIST_OPTION,
     STRIP_TRAILING_CR_OPTION,
     SUPPRESS_BLANK_EMPTY_OPTION,
     SUPPRESS_COMMON_LINES_OPTION,
     TABSIZE_OPTION,
+    THREADS_OPTION,
+    TIME_BUDGET_OPTION,
     TO_FILE_OPTION,
 
     /* These options must be in sequence.  */
@@ -151,6 +163,8 @@ enum {
     COLOR_PALETTE_OPTION,
 
     PRESUME_OUTPUT_TTY_OPTION,
+    NO_SIMD_OPTION,
+    STATS_OPTION,
 };
 
 static char const group_format_option[][sizeof "--unchanged-group-format"] =
@@ -170,11 +184,14 @@ static char const line_format_option[][sizeof "--unchanged-line-format"] =
 
 static struct option const longopts[] =
 {
+    {"algorithm", 1, 0, ALGORITHM_OPTION},
     {"binary", 0, 0, BINARY_OPTION},
     {"brief", 0, 0, 'q'},
     {"changed-group-format", 1, 0, CHANGED_GROUP_FORMAT_OPTION},
     {"color", 2, 0, COLOR_OPTION},
     {"context", 2, 0, 'C'},
+    {"cost-budget", 1, 0, COST_BUDGET_OPTION},
+    {"digest-cache", 1, 0, DIGEST_CACHE_OPTION},
     {"ed", 0, 0, 'e'},
     {"exclude", 1, 0, 'x'},
     {"exclude-from", 1, 0, 'X'},
@@ -197,6 +214,8 @@ static struct option const longopts[] =
     {"label", 1, 0, 'L'},
     {"left-column", 0, 0, LEFT_COLUMN_OPTION},
     {"line-format", 1, 0, LINE_FORMAT_OPTION},
+    {"max-hunks", 1, 0, MAX_HUNKS_OPTION},
+    {"max-memory", 1, 0, MAX_MEMORY_OPTION},
     {"minimal", 0, 0, 'd'},
     {"new-file", 0, 0, 'N'},
     {"new-group-format", 1, 0, NEW_GROUP_FORMAT_OPTION},
@@ -208,6 +227,8 @@ static struct option const longopts[] =
     {"old-line-format", 1, 0, OLD_LINE_FORMAT_OPTION},
     {"paginate", 0, 0, 'l'},
     {"palette", 1, 0, COLOR_PALETTE_OPTION},
+    {"prefetch", 0, 0, PREFETCH_OPTION},
+    {"progressive", 0, 0, PROGRESSIVE_OPTION},
     {"rcs", 0, 0, 'n'},
     {"recursive", 0, 0, 'r'},
     {"report-identical-files", 0, 0, 's'},
@@ -222,6 +243,8 @@ static struct option const longopts[] =
     {"suppress-common-lines", 0, 0, SUPPRESS_COMMON_LINES_OPTION},
     {"tabsize", 1, 0, TABSIZE_OPTION},
     {"text", 0, 0, 'a'},
+    {"threads", 1, 0, THREADS_OPTION},
+    {"time-budget", 1, 0, TIME_BUDGET_OPTION},
     {"to-file", 1, 0, TO_FILE_OPTION},
     {"unchanged-group-format", 1, 0, UNCHANGED_GROUP_FORMAT_OPTION},
     {"unchanged-line-format", 1, 0, UNCHANGED_LINE_FORMAT_OPTION},
@@ -232,6 +255,10 @@ static struct option const longopts[] =
 
     /* This is solely for testing.  Do not document.  */
     {"-presume-output-tty", no_argument, NULL, PRESUME_OUTPUT_TTY_OPTION},
+    {"-no-simd", no_argument, NULL, NO_SIMD_OPTION},
+
+    /* This is solely for performance tuning.  Do not document.  */
+    {"-stats", no_argument, NULL, STATS_OPTION},
     {0, 0, 0, 0}
 };
 
@@ -284,8 +311,10 @@ main(int argc, char **argv) {
     bool show_c_function = false;
     char const *from_file = NULL;
     char const *to_file = NULL;
+    char const *digest_cache = NULL;
     intmax_t numval;
     char *numend;
+    bool no_simd = false;
 
     /* Do our initializations.  */
     exit_failure = EXIT_TROUBLE;
@@ -530,6 +559,10 @@ main(int argc, char **argv) {
                 }
                 break;
 
+            case ALGORITHM_OPTION:
+                specify_algorithm(optarg);
+                break;
+
             case BINARY_OPTION:
 #if O_BINARY
           binary = true;
@@ -538,6 +571,17 @@ main(int argc, char **argv) {
 #endif
                 break;
 
+            case COST_BUDGET_OPTION:
+                numval = strtoimax(optarg, &numend, 10);
+                if (*numend || numval <= 0)
+                    try_help("invalid cost budget '%s'", optarg);
+                cost_budget = numval;
+                break;
+
+            case DIGEST_CACHE_OPTION:
+                specify_value(&digest_cache, optarg, "--digest-cache");
+                break;
+
             case FROM_FILE_OPTION:
                 specify_value(&from_file, optarg, "--from-file");
                 break;
@@ -573,6 +617,23 @@ main(int argc, char **argv) {
                     specify_value(&line_format[i], optarg, "--line-format");
                 break;
 
+            case MAX_HUNKS_OPTION:
+                numval = strtoimax(optarg, &numend, 10);
+                if (*numend || numval <= 0)
+                    try_help("invalid hunk count '%s'", optarg);
+                max_hunks = numval;
+                progressive = true;
+                break;
+
+            case MAX_MEMORY_OPTION: {
+                intmax_t size;
+                if (xstrtoimax(optarg, 0, 10, &size, "kKMGTPEZY0") != LONGINT_OK
+                    || size <= 0 || SIZE_MAX < size)
+                    try_help("invalid --max-memory value '%s'", optarg);
+                max_memory = size;
+                break;
+            }
+
             case NO_DEREFERENCE_OPTION:
                 no_dereference_symlinks = true;
                 break;
@@ -585,6 +646,14 @@ main(int argc, char **argv) {
                 specify_style(OUTPUT_NORMAL);
                 break;
 
+            case PREFETCH_OPTION:
+                prefetch = true;
+                break;
+
+            case PROGRESSIVE_OPTION:
+                progressive = true;
+                break;
+
             case SDIFF_MERGE_ASSIST_OPTION:
                 specify_style(OUTPUT_SDIFF);
                 sdiff_merge_assist = true;
@@ -614,6 +683,21 @@ main(int argc, char **argv) {
                 }
                 break;
 
+            case THREADS_OPTION:
+                numval = strtoimax(optarg, &numend, 10);
+                if (*numend || numval <= 0)
+                    try_help("invalid thread count '%s'", optarg);
+                threads = MIN (numval, THREADS_MAX);
+                break;
+
+            case TIME_BUDGET_OPTION:
+                numval = strtoimax(optarg, &numend, 10);
+                if (*numend || numval <= 0)
+                    try_help("invalid time budget '%s'", optarg);
+                time_budget = (numval <= INTMAX_MAX / 2 / 1000000
+                               ? numval * 1000000 : INTMAX_MAX / 2);
+                break;
+
             case TO_FILE_OPTION:
                 specify_value(&to_file, optarg, "--to-file");
                 break;
@@ -647,6 +731,14 @@ main(int argc, char **argv) {
                 presume_output_tty = true;
                 break;
 
+            case NO_SIMD_OPTION:
+                no_simd = true;
+                break;
+
+            case STATS_OPTION:
+                report_stats = true;
+                break;
+
             default:
                 try_help(NULL, NULL);
         }
@@ -668,6 +760,13 @@ main(int argc, char **argv) {
             specify_style(OUTPUT_NORMAL);
     }
 
+    /* An ed script lists its changes from the end of the file
+       backwards, so it cannot be output as the files are compared.  */
+    if (output_style == OUTPUT_ED && progressive)
+        try_help(max_hunks
+                 ? "--max-hunks is not supported with --ed"
+                 : "--progressive is not supported with --ed", NULL);
+
     if (output_style != OUTPUT_CONTEXT || hard_locale(LC_TIME)) {
 #if (defined STAT_TIMESPEC || defined STAT_TIMESPEC_NS \
      || defined HAVE_STRUCT_STAT_ST_SPARE1)
@@ -689,6 +788,8 @@ main(int argc, char **argv) {
 
     if (!tabsize)
         tabsize = 8;
+    if (!threads)
+        threads = 1;
     if (!width)
         width = 130; {
         /* Maximize first the half line width, and then the gutter width,
@@ -751,6 +852,12 @@ main(int argc, char **argv) {
 
     switch_string = option_list(argv + 1, optind - 1);
 
+    init_scan(no_simd);
+    init_lines_differ();
+
+    if (digest_cache)
+        open_digest_cache(digest_cache);
+
     if (from_file) {
         if (to_file)
             fatal("--from-file and --to-file both specified");
@@ -782,6 +889,11 @@ main(int argc, char **argv) {
     /* Print any messages that were saved up for last.  */
     print_message_queue();
 
+    close_digest_cache();
+
+    if (report_stats)
+        print_stats();
+
     check_stdout();
     exit(exit_status);
     return exit_status;
@@ -938,8 +1050,29 @@ static char const *const option_help_msgid[] = {
     C    the character C (other characters represent themselves)"),
     "",
     N_("-d, --minimal            try hard to find a smaller set of changes"),
+    N_("    --algorithm=ALG      find differences with ALG: 'myers' (the default),\n"
+        "                           'patience', or 'histogram'"),
     N_("    --horizon-lines=NUM  keep NUM lines of the common prefix and suffix"),
     N_("    --speed-large-files  assume large files and many scattered small changes"),
+    N_("    --threads=NUM        use up to NUM threads to compare large files"),
+    N_("    --prefetch           when comparing directories, look up files and start\n"
+        "                           reading small ones on another thread before\n"
+        "                           comparing them"),
+    N_("    --cost-budget=NUM    search at most about NUM diagonals to compare two\n"
+        "                           files; if that is not enough, warn that the\n"
+        "                           result may not be minimal"),
+    N_("    --time-budget=MS     spend at most about MS milliseconds comparing two\n"
+        "                           files; if that is not enough, warn that the\n"
+        "                           result may not be minimal"),
+    N_("    --max-memory=SIZE    compare large files in pieces that fit in about SIZE\n"
+        "                           bytes; the result may not be minimal"),
+    N_("    --progressive        output the differences of large files a piece at a\n"
+        "                           time as they are found; the result may not be\n"
+        "                           minimal; not with --ed"),
+    N_("    --max-hunks=NUM      output at most NUM hunks for two files, and stop\n"
+        "                           comparing them then; implies --progressive"),
+    N_("    --digest-cache=FILE  with -q, record file digests in FILE, and use them\n"
+        "                           to compare files that have not changed since"),
     N_("    --color[=WHEN]       color output; WHEN is 'never', 'always', or 'auto';\n"
         "                           plain --color means --color='auto'"),
     N_("    --palette=PALETTE    the colors to use when --color is active; PALETTE is\n"
@@ -1022,6 +1155,19 @@ specify_colors_style(char const *value) {
 }
 
 
+/* Set the algorithm that finds differences.  */
+static void
+specify_algorithm(char const *value) {
+    if (STREQ(value, "myers"))
+        diff_algorithm = ALGORITHM_MYERS;
+    else if (STREQ(value, "patience"))
+        diff_algorithm = ALGORITHM_PATIENCE;
+    else if (STREQ(value, "histogram"))
+        diff_algorithm = ALGORITHM_HISTOGRAM;
+    else
+        try_help("invalid algorithm '%s'", value);
+}
+
 /* Set the last-modified time of *ST to be the current time.  */
 
 static void
@@ -1057,6 +1203,7 @@ compare_files(struct comparison const *parent,
     register int f;
     int status = EXIT_SUCCESS;
     bool same_files;
+    int cached;
     char *free0;
     char *free1;
 
@@ -1320,6 +1467,17 @@ compare_files(struct comparison const *parent,
                 file_label[0] ? file_label[0] : cmp.file[0].name,
                 file_label[1] ? file_label[1] : cmp.file[1].name);
         status = EXIT_FAILURE;
+    } else if (files_can_be_treated_as_binary
+               && cmp.file[0].stat.st_size == cmp.file[1].stat.st_size
+               && 0 <= (cached = cached_difference(&cmp.file[0].stat,
+                                                   &cmp.file[1].stat))) {
+        /* The digest cache knows whether the files differ.  */
+        if (cached) {
+            message("Files %s and %s differ\n",
+                    file_label[0] ? file_label[0] : cmp.file[0].name,
+                    file_label[1] ? file_label[1] : cmp.file[1].name);
+            status = EXIT_FAILURE;
+        }
     } else {
         /* Both exist and neither is a directory.  */
 
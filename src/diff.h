@@ -52,6 +52,20 @@ enum colors_style
   ALWAYS,
 };
 
+/* How to find the differences between two files.  */
+enum diff_algorithm
+{
+  /* Myers's O(ND) algorithm, as implemented by compareseq.  */
+  ALGORITHM_MYERS,
+
+  /* Patience diff: match the lines that occur exactly once in both
+     files, and use Myers's algorithm only between them.  */
+  ALGORITHM_PATIENCE,
+
+  /* Histogram diff: split the files at their rarest matching lines.  */
+  ALGORITHM_HISTOGRAM
+};
+
 /* Variables for command line options */
 
 #ifndef GDIFF_MAIN
@@ -221,6 +235,29 @@ XTERN char *switch_string;
    density of changes.  */
 XTERN bool speed_large_files;
 
+/* If nonzero, the approximate number of bytes of memory that diff may
+   use to compare two files (--max-memory).  Larger files are compared
+   a window at a time.  */
+XTERN size_t max_memory;
+
+/* Compare large files a window at a time, starting with small windows,
+   and output the differences in each window before reading the next
+   (--progressive).  */
+XTERN bool progressive;
+
+/* If nonzero, output at most this many hunks for two files, and stop
+   comparing them then (--max-hunks).  */
+XTERN intmax_t max_hunks;
+
+/* Maximum number of threads to use when comparing large files (--threads).  */
+XTERN int threads;
+enum { THREADS_MAX = 256 };
+
+/* When comparing directories, look up files and start reading small
+   ones on a thread of their own, ahead of their comparison
+   (--prefetch).  */
+XTERN bool prefetch;
+
 /* Patterns that match file names to be excluded.  */
 XTERN struct exclude *excluded;
 
@@ -228,8 +265,67 @@ XTERN struct exclude *excluded;
    slower) but will find a guaranteed minimal set of changes.  */
 XTERN bool minimal;
 
+/* The algorithm that finds differences (--algorithm).  */
+XTERN enum diff_algorithm diff_algorithm;
+
+/* If nonzero, how many diagonals of the edit graph the comparison of
+   two files may search in all (--cost-budget), and for how many
+   nanoseconds (--time-budget).  After half of either, it settles for
+   heuristic partitions, and after all of either, it reports what
+   remains as changed, so its result may not be minimal.  */
+XTERN intmax_t cost_budget;
+XTERN intmax_t time_budget;
+
 /* The strftime format to use for time strings.  */
 XTERN char const *time_format;
+
+/* Counters reported by the undocumented ---stats option, which is
+   for performance tuning.  They accumulate over all files compared.  */
+struct stats
+{
+  /* Lines put into equivalence classes.  */
+  intmax_t lines_hashed;
+
+  /* Classes that had the same hash as a line but did not match it.  */
+  intmax_t hash_collisions;
+
+  /* Occupied hash table slots with a different hash that were probed
+     while looking up a line.  */
+  intmax_t probe_collisions;
+
+  /* Nanoseconds spent reading input files and preparing their text,
+     and how much of that was spent on both files at once.  */
+  intmax_t read_nsec;
+  intmax_t read_overlap_nsec;
+
+  /* Bytes in use in line and equivalence class tables when they had
+     to be reallocated because they were too small.  */
+  intmax_t table_bytes_reallocated;
+
+  /* Canonical forms built for equivalence classes' lines.  */
+  intmax_t canonical_forms;
+
+  /* Files whose digests were found in the digest cache, and files
+     whose digests were computed.  */
+  intmax_t digest_cache_hits;
+  intmax_t files_digested;
+
+  /* Subproblems of the comparison handed to other threads.  */
+  intmax_t subproblems_spawned;
+
+  /* Comparisons of two files that went over half their budget, and
+     over all of it, so that their results may not be minimal.  */
+  intmax_t comparisons_over_half_budget;
+  intmax_t comparisons_over_budget;
+
+  /* Blocks that were reused from an earlier comparison instead of
+     being allocated.  */
+  intmax_t allocations_saved;
+};
+XTERN struct stats stats;
+
+/* Print STATS to standard error when exiting (---stats).  */
+XTERN bool report_stats;
 
 /* The result of comparison is an "edit script": a chain of 'struct change'.
    Each 'struct change' represents one place where some lines are deleted
@@ -252,6 +348,9 @@ struct change
   bool ignore;			/* Flag used in context.c.  */
 };
 
+/* The type of a hash value.  */
+typedef size_t hash_value;
+
 /* Structures that describe the input files.  */
 
 /* Data on one input file being compared.  */
@@ -284,9 +383,14 @@ struct file_data {
     char const *prefix_end;
 
     /* Count of lines in the prefix.
-       There are this many lines in the file before linbuf[0].  */
+       There are this many lines in the file before linbuf[0],
+       not counting window_lines.  */
     lin prefix_lines;
 
+    /* With --max-memory, count of lines in the file before the window
+       now being compared.  */
+    lin window_lines;
+
     /* Pointer to start of suffix of this file to ignore when hashing.  */
     char const *suffix_begin;
 
@@ -295,17 +399,6 @@ struct file_data {
        of another file to generate differences.  */
     lin *equivs;
 
-    /* Vector, like the previous one except that
-       the elements for discarded lines have been squeezed out.  */
-    lin *undiscarded;
-
-    /* Vector mapping virtual line numbers (not counting discarded lines)
-       to real ones (counting those lines).  Both are origin-0.  */
-    lin *realindexes;
-
-    /* Total number of nondiscarded lines.  */
-    lin nondiscarded_lines;
-
     /* Vector, indexed by real origin-0 line number,
        containing 1 for a line that is an insertion or a deletion.
        The results of comparison are stored here.  */
@@ -317,6 +410,10 @@ struct file_data {
     /* 1 if at end of file.  */
     bool eof;
 
+    /* 1 if buffer is a private memory mapping of the file rather than
+       malloced storage; see release_buffers.  */
+    bool mapped;
+
     /* 1 more than the maximum equivalence value used for this or its
        sibling file.  */
     lin equiv_max;
@@ -347,6 +444,25 @@ XTERN FILE *outfile;
 /* analyze.c */
 extern int diff_2_files (struct comparison *);
 
+/* How much of its budget (--cost-budget and --time-budget) the
+   comparison of two files has used.  */
+enum budget_level
+{
+  WITHIN_BUDGET,
+
+  /* Over half the budget: settle for a heuristic partition of each
+     subproblem instead of searching for the best one.  */
+  OVER_HALF_BUDGET,
+
+  /* Over the budget: report each remaining subproblem as one change.  */
+  OVER_BUDGET
+};
+extern enum budget_level spend_budget (intmax_t);
+
+/* compare.c */
+extern void compare_lines (struct file_data[], char const *const[2]);
+extern void compare_lines_32 (struct file_data[], char const *const[2]);
+
 /* context.c */
 extern void print_context_header (struct file_data[], char const * const *, bool);
 extern void print_context_script (struct change *, bool);
@@ -357,6 +473,24 @@ extern int diff_dirs (struct comparison const *,
                                char const *, char const *));
 extern char *find_dir_file_pathname (char const *, char const *);
 
+/* digest.c */
+enum { DIGEST_SIZE = 32 };
+struct digest_ctx
+{
+  uint32_t h[8];
+  unsigned char block[64];
+  uint64_t total;
+};
+extern void digest_init (struct digest_ctx *);
+extern void digest_update (struct digest_ctx *, void const *, size_t);
+extern void digest_finish (struct digest_ctx *, unsigned char[DIGEST_SIZE]);
+extern void open_digest_cache (char const *);
+extern bool digest_cacheable (struct stat const *);
+extern int cached_difference (struct stat const *, struct stat const *);
+extern void record_digest (struct stat const *,
+                           unsigned char const[DIGEST_SIZE]);
+extern void close_digest_cache (void);
+
 /* ed.c */
 extern void print_ed_script (struct change *);
 extern void pr_forward_ed_script (struct change *);
@@ -367,6 +501,13 @@ extern void print_ifdef_script (struct change *);
 /* io.c */
 extern void file_block_read (struct file_data *, size_t);
 extern bool read_files (struct file_data[], bool);
+extern bool start_windows (struct file_data[], bool, size_t);
+extern void grow_windows (struct file_data[], size_t);
+extern bool read_window (struct file_data[]);
+extern void release_buffers (struct file_data[]);
+#if USE_POSIX_THREADS
+extern void run_threads (void *(*) (void *), void *, size_t, int);
+#endif
 
 /* normal.c */
 extern void print_normal_script (struct change *);
@@ -374,6 +515,16 @@ extern void print_normal_script (struct change *);
 /* rcs.c */
 extern void print_rcs_script (struct change *);
 
+/* scan.c */
+extern char const *(*hash_line) (char const *, hash_value *);
+extern size_t (*common_prefix) (char const *, char const *, size_t);
+extern size_t (*common_suffix) (char const *, char const *, size_t);
+extern size_t (*count_newlines) (char const *, size_t);
+extern size_t (*canon_line) (char const *, size_t, char *);
+extern size_t (*strip_cr) (char *, size_t);
+extern size_t (*printable_prefix) (char const *, size_t);
+extern void init_scan (bool);
+
 /* side.c */
 extern void print_sdiff_script (struct change *);
 
@@ -381,11 +532,31 @@ extern void print_sdiff_script (struct change *);
 extern char const change_letter[4];
 extern char const pr_program[];
 extern char *concat (char const *, char const *, char const *);
-extern bool lines_differ (char const *, char const *) _GL_ATTRIBUTE_PURE;
+extern bool (*lines_differ) (char const *, char const *);
+extern void init_lines_differ (void);
 extern lin translate_line_number (struct file_data const *, lin);
 extern struct change *find_change (struct change *);
 extern struct change *find_reverse_change (struct change *);
 extern void *zalloc (size_t);
+
+/* The blocks that a comparison can take from those that util.c keeps
+   for reuse, and give back when it is done with them.  */
+enum spare
+{
+  SPARE_FLAGS,			/* analyze.c: changed lines.  */
+  SPARE_DISCARDS,		/* analyze.c: discarded lines.  */
+  SPARE_COUNTS,			/* analyze.c: lines in each class.  */
+  SPARE_SCRIPT,			/* analyze.c: the edit script.  */
+  SPARE_INDEXES,		/* compare.c: undiscarded lines.  */
+  SPARE_DIAGS,			/* compare.c: the diagonals.  */
+  SPARE_EQLINES,		/* io.c: equivalence classes.  */
+  SPARE_SLOTS,			/* io.c: the hash table.  */
+  SPARES
+};
+extern void *spare_take (enum spare, size_t, size_t);
+extern void *spare_ztake (enum spare, size_t, size_t);
+extern size_t spare_size (enum spare);
+extern void spare_give (enum spare, void *, size_t);
 extern enum changes analyze_hunk (struct change *, lin *, lin *, lin *, lin *);
 extern void begin_output (void);
 extern void debug_script (struct change *);
@@ -396,14 +567,17 @@ extern void message5 (char const *, char const *, char const *,
                       char const *, char const *);
 extern void output_1_line (char const *, char const *, char const *,
                            char const *);
+extern void output_spaces (size_t);
 extern void perror_with_name (char const *);
 extern void pfatal_with_name (char const *) __attribute__((noreturn));
 extern void print_1_line (char const *, char const * const *);
 extern void print_1_line_nl (char const *, char const * const *, bool);
 extern void print_message_queue (void);
 extern void print_number_range (char, struct file_data *, lin, lin);
+extern bool hunk_limit_reached (void);
 extern void print_script (struct change *, struct change * (*) (struct change *),
                           void (*) (struct change *));
+extern void print_stats (void);
 extern void setup_output (char const *, char const *, bool);
 extern void translate_range (struct file_data const *, lin, lin,
                              printint *, printint *);
@@ -0,0 +1,422 @@
+/* Cache of file content digests for GNU DIFF.
+
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+#include <binary-io.h>
+#include <error.h>
+#include <stat-time.h>
+#include <timespec.h>
+#include <xalloc.h>
+
+/* With --digest-cache=FILE, diff -q records the SHA-256 digest of the
+   contents of each regular file that it reads in full, keyed by the
+   file's device, inode number, size, and modification and status
+   change times, and decides whether two files of the same size differ
+   by comparing their recorded digests when neither file has changed
+   since.  Any change to a file's contents changes its status change
+   time, which the file's owner cannot set.
+
+   FILE holds a header followed by an array of entries.  It is read
+   once, and replaced at exit by renaming a new file over it, so that
+   concurrent invocations always see a whole cache; each merges the
+   entries that the others added before replacing it.  A file that
+   changed too recently is not recorded, since it might change again
+   without changing its time stamps.  */
+
+/* SHA-256, as specified by FIPS 180-4.  */
+
+static uint32_t const sha256_k[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+#define ROR32(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+/* Process the 64-byte block P into the state H.  */
+static void
+sha256_block (uint32_t h[8], unsigned char const *p)
+{
+  uint32_t w[64];
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+  uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = ((uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+            | (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3]);
+  for (; i < 64; i++)
+    {
+      uint32_t s0 = ROR32 (w[i - 15], 7) ^ ROR32 (w[i - 15], 18)
+                    ^ w[i - 15] >> 3;
+      uint32_t s1 = ROR32 (w[i - 2], 17) ^ ROR32 (w[i - 2], 19)
+                    ^ w[i - 2] >> 10;
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  for (i = 0; i < 64; i++)
+    {
+      uint32_t t1 = (hh + (ROR32 (e, 6) ^ ROR32 (e, 11) ^ ROR32 (e, 25))
+                     + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i]);
+      uint32_t t2 = ((ROR32 (a, 2) ^ ROR32 (a, 13) ^ ROR32 (a, 22))
+                     + ((a & b) ^ (a & c) ^ (b & c)));
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+  h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void
+digest_init (struct digest_ctx *ctx)
+{
+  static uint32_t const initial[8] =
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+  memcpy (ctx->h, initial, sizeof initial);
+  ctx->total = 0;
+}
+
+void
+digest_update (struct digest_ctx *ctx, void const *buf, size_t size)
+{
+  unsigned char const *p = buf;
+  size_t used = ctx->total % sizeof ctx->block;
+  ctx->total += size;
+
+  if (used)
+    {
+      size_t n = MIN (size, sizeof ctx->block - used);
+      memcpy (ctx->block + used, p, n);
+      p += n;
+      size -= n;
+      if (used + n < sizeof ctx->block)
+        return;
+      sha256_block (ctx->h, ctx->block);
+    }
+  for (; sizeof ctx->block <= size; p += sizeof ctx->block,
+         size -= sizeof ctx->block)
+    sha256_block (ctx->h, p);
+  memcpy (ctx->block, p, size);
+}
+
+void
+digest_finish (struct digest_ctx *ctx, unsigned char digest[DIGEST_SIZE])
+{
+  uint64_t bits = ctx->total * CHAR_BIT;
+  size_t used = ctx->total % sizeof ctx->block;
+  int i;
+
+  ctx->block[used++] = 0x80;
+  if (sizeof ctx->block - 8 < used)
+    {
+      memset (ctx->block + used, 0, sizeof ctx->block - used);
+      sha256_block (ctx->h, ctx->block);
+      used = 0;
+    }
+  memset (ctx->block + used, 0, sizeof ctx->block - 8 - used);
+  for (i = 0; i < 8; i++)
+    ctx->block[sizeof ctx->block - 1 - i] = bits >> (8 * i);
+  sha256_block (ctx->h, ctx->block);
+
+  for (i = 0; i < DIGEST_SIZE; i++)
+    digest[i] = ctx->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/* The cache.  */
+
+/* The first bytes of a cache file.  The record size guards against
+   reading entries written with a different layout.  */
+static char const cache_magic[16] = "GNU diff sha256";
+
+/* A cache entry.  The time stamps are nanosecond counts.  */
+struct digest_entry
+{
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime;
+  int64_t ctime;
+  unsigned char digest[DIGEST_SIZE];
+};
+
+/* A file that changed this many seconds before the cache was loaded,
+   or later, might change again within the resolution of its time
+   stamps, so it is not recorded.  */
+enum { RACY_SECONDS = 2 };
+
+/* The name of the cache file, or NULL if there is no cache.  */
+static char const *cache_name;
+
+/* The entries, in an open-addressing hash table keyed by device and
+   inode number, with linear probing.  An entry with a zero size is
+   empty; empty files are not recorded.  */
+static struct digest_entry *entries;
+
+/* One less than the number of slots in ENTRIES, and the number of
+   slots in use.  */
+static size_t entries_mask;
+static size_t entries_used;
+
+/* True if entries have been recorded since the cache was loaded.  */
+static bool cache_changed;
+
+/* When the cache was loaded.  */
+static struct timespec load_time;
+
+static int64_t
+nsec_of (struct timespec t)
+{
+  return (int64_t) t.tv_sec * TIMESPEC_HZ + t.tv_nsec;
+}
+
+/* Return the slot for the file with device DEV and inode number INO:
+   the slot holding its entry, or else the empty slot for it.  */
+static struct digest_entry * _GL_ATTRIBUTE_PURE
+find_slot (uint64_t dev, uint64_t ino)
+{
+  size_t h = (ino * 0x9e3779b97f4a7c15u) ^ dev;
+  size_t i;
+  for (i = (h ^ h >> 29) & entries_mask; ; i = (i + 1) & entries_mask)
+    if (! entries[i].size
+        || (entries[i].dev == dev && entries[i].ino == ino))
+      return &entries[i];
+}
+
+/* Add entry E to the table, replacing any entry for the same file,
+   except that if NEWER_WINS an entry with a later status change time
+   is kept.  Return true if E was added.  */
+static bool
+add_entry (struct digest_entry const *e, bool newer_wins)
+{
+  if (entries_mask / 4 * 3 <= entries_used)
+    {
+      struct digest_entry *old = entries;
+      size_t old_mask = entries_mask;
+      size_t i;
+      if (SIZE_MAX / (2 * sizeof *entries) <= entries_mask + 1)
+        xalloc_die ();
+      entries_mask = 2 * entries_mask + 1;
+      entries = xcalloc (entries_mask + 1, sizeof *entries);
+      for (i = 0; i <= old_mask; i++)
+        if (old[i].size)
+          *find_slot (old[i].dev, old[i].ino) = old[i];
+      free (old);
+    }
+
+  struct digest_entry *slot = find_slot (e->dev, e->ino);
+  if (slot->size)
+    {
+      if (newer_wins && e->ctime < slot->ctime)
+        return false;
+    }
+  else
+    entries_used++;
+  *slot = *e;
+  return true;
+}
+
+/* Read the entries of the cache file, if it exists and is valid, into
+   the table.  Keep the newer entry for a file that is already there.
+   Return the number of entries added.  */
+static size_t
+read_cache (void)
+{
+  size_t added = 0;
+  int fd = open (cache_name, O_RDONLY | O_BINARY);
+  if (fd < 0)
+    return 0;
+
+  FILE *fp = fdopen (fd, "rb");
+  if (! fp)
+    {
+      close (fd);
+      return 0;
+    }
+
+  char magic[sizeof cache_magic];
+  uint32_t record_size = 0;
+  if (fread (magic, sizeof magic, 1, fp) == 1
+      && memcmp (magic, cache_magic, sizeof magic) == 0
+      && fread (&record_size, sizeof record_size, 1, fp) == 1
+      && record_size == sizeof (struct digest_entry))
+    {
+      struct digest_entry e;
+      while (fread (&e, sizeof e, 1, fp) == 1)
+        if (0 < e.size)
+          added += add_entry (&e, true);
+    }
+  fclose (fp);
+  return added;
+}
+
+/* Use FILE as the digest cache.  */
+
+void
+open_digest_cache (char const *file)
+{
+  cache_name = file;
+  entries_mask = 1023;
+  entries = xcalloc (entries_mask + 1, sizeof *entries);
+  entries_used = 0;
+  load_time = current_timespec ();
+  read_cache ();
+}
+
+/* Make E the entry for the file with status ST, without a digest.  */
+static void
+entry_of (struct digest_entry *e, struct stat const *st)
+{
+  e->dev = st->st_dev;
+  e->ino = st->st_ino;
+  e->size = st->st_size;
+  e->mtime = nsec_of (get_stat_mtime (st));
+  e->ctime = nsec_of (get_stat_ctime (st));
+}
+
+/* Whether the digests of the files with status ST can be cached.  */
+
+bool _GL_ATTRIBUTE_PURE
+digest_cacheable (struct stat const *st)
+{
+  return cache_name && S_ISREG (st->st_mode) && 0 < st->st_size;
+}
+
+/* Look up the file with status ST in the cache.  If it has an entry
+   that is still valid, store its digest in DIGEST and return true.  */
+
+static bool
+lookup_digest (struct stat const *st, unsigned char digest[DIGEST_SIZE])
+{
+  struct digest_entry key;
+  entry_of (&key, st);
+  struct digest_entry const *e = find_slot (key.dev, key.ino);
+  if (! (e->size == key.size && e->mtime == key.mtime
+         && e->ctime == key.ctime))
+    return false;
+  memcpy (digest, e->digest, DIGEST_SIZE);
+  return true;
+}
+
+/* Return 0 if the cache shows that the files with status ST0 and ST1,
+   which have the same size, have the same contents, 1 if it shows
+   that they differ, and -1 if it does not know.  */
+
+int
+cached_difference (struct stat const *st0, struct stat const *st1)
+{
+  unsigned char d0[DIGEST_SIZE], d1[DIGEST_SIZE];
+  if (! (digest_cacheable (st0) && digest_cacheable (st1)
+         && lookup_digest (st0, d0) && lookup_digest (st1, d1)))
+    return -1;
+  stats.digest_cache_hits += 2;
+  return memcmp (d0, d1, DIGEST_SIZE) != 0;
+}
+
+/* Record DIGEST as the digest of the contents of the file with status
+   ST, unless the file changed too recently.  */
+
+void
+record_digest (struct stat const *st, unsigned char const digest[DIGEST_SIZE])
+{
+  struct digest_entry e;
+  entry_of (&e, st);
+  int64_t racy = nsec_of (load_time) - (int64_t) RACY_SECONDS * TIMESPEC_HZ;
+  stats.files_digested++;
+  if (racy <= e.mtime || racy <= e.ctime)
+    return;
+  memcpy (e.digest, digest, DIGEST_SIZE);
+  add_entry (&e, false);
+  cache_changed = true;
+}
+
+/* Write the cache file, if entries have been recorded, merging the
+   entries that other invocations have added to it meanwhile.  */
+
+void
+close_digest_cache (void)
+{
+  if (! (cache_name && cache_changed))
+    return;
+
+  /* Keep this invocation's entries over the file's, unless the file's
+     are newer.  */
+  read_cache ();
+
+  char *tmp = xmalloc (strlen (cache_name) + sizeof ".XXXXXX");
+  strcpy (stpcpy (tmp, cache_name), ".XXXXXX");
+  int fd = mkstemp (tmp);
+
+  /* mkstemp creates the file readable only by its owner; give it the
+     mode of the file it replaces, or the mode a new file would get.  */
+  struct stat st;
+  mode_t mode;
+  if (stat (cache_name, &st) == 0)
+    mode = st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+  else
+    {
+      mode_t mask = umask (0);
+      umask (mask);
+      mode = ((S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+              & ~mask);
+    }
+
+  FILE *fp = (fd < 0 || fchmod (fd, mode) != 0 ? NULL
+              : fdopen (fd, "wb"));
+  bool ok = !!fp;
+  if (0 <= fd && ! fp)
+    close (fd);
+  if (ok)
+    {
+      uint32_t record_size = sizeof (struct digest_entry);
+      size_t i;
+      ok = (fwrite (cache_magic, sizeof cache_magic, 1, fp) == 1
+            && fwrite (&record_size, sizeof record_size, 1, fp) == 1);
+      for (i = 0; ok && i <= entries_mask; i++)
+        if (entries[i].size)
+          ok = fwrite (&entries[i], sizeof entries[i], 1, fp) == 1;
+      ok &= fclose (fp) == 0;
+      ok = ok && rename (tmp, cache_name) == 0;
+    }
+  if (! ok)
+    {
+      error (0, errno, _("cannot update digest cache '%s'"), cache_name);
+      if (0 <= fd)
+        unlink (tmp);
+    }
+  free (tmp);
+}
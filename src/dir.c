@@ -25,6 +25,10 @@
 #include <setjmp.h>
 #include <xalloc.h>
 
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
+
 /* Read the directory named by DIR and store into DIRDATA a sorted vector
    of filenames for its contents.  DIR->desc == -1 means this directory is
    known to be nonexistent, so set DIRDATA to an empty vector.
@@ -193,6 +197,159 @@ compare_names_for_qsort (void const *file1, void const *file2)
   return file_name_cmp (name1, name2);
 }
 
+#if USE_POSIX_THREADS
+/* With --prefetch, diff_dirs runs a prefetcher thread that looks up the
+   files it is about to compare, and asks the kernel to start reading
+   the small ones, while diff_dirs compares earlier files.  The
+   comparisons themselves still stat, open and read the files in
+   order, but usually find their metadata and data already cached, so
+   their latency overlaps the work on earlier files.  */
+
+/* How many files to look up ahead of the comparisons.  */
+enum { PREFETCH_AHEAD = 64 };
+
+/* Regular files no larger than this are read ahead.  Larger ones
+   benefit less, and may not be read at all, for instance by --brief
+   if their sizes differ.  */
+enum { PREFETCH_MAX_SIZE = 1024 * 1024 };
+
+struct prefetcher
+{
+  /* The directories, and the remaining names in each to look up.  */
+  char const *dir[2];
+  char const **names[2];
+
+  /* The number of files that diff_dirs has compared, and whether it
+     is done with the directories.  Both are protected by LOCK.  */
+  size_t compared;
+  bool done;
+
+  pthread_mutex_t lock;
+  pthread_cond_t progress;
+  pthread_t thread;
+};
+
+/* Look up the file NAME in the directory DIR, and start reading it if
+   it is a small regular file.  */
+
+static void
+prefetch_file (char const *dir, char const *name)
+{
+  char *file = file_name_concat (dir, name, NULL);
+  struct stat st;
+
+  if ((no_dereference_symlinks ? lstat (file, &st) : stat (file, &st)) == 0
+      && S_ISREG (st.st_mode)
+      && 0 < st.st_size && st.st_size <= PREFETCH_MAX_SIZE)
+    {
+#ifdef POSIX_FADV_WILLNEED
+      int fd = open (file, O_RDONLY | O_NONBLOCK);
+      if (0 <= fd)
+        {
+          posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+          close (fd);
+        }
+#endif
+    }
+
+  free (file);
+}
+
+/* Look up the files of the prefetcher P in about the order diff_dirs
+   compares them, keeping at most PREFETCH_AHEAD files ahead.  */
+
+static void *
+prefetch_files (void *p)
+{
+  struct prefetcher *pf = p;
+  size_t fetched[2] = { 0, 0 };
+
+  for (;;)
+    {
+      int f;
+
+      pthread_mutex_lock (&pf->lock);
+      while (! pf->done
+             && pf->compared + PREFETCH_AHEAD <= fetched[0] + fetched[1])
+        pthread_cond_wait (&pf->progress, &pf->lock);
+      bool done = pf->done;
+      pthread_mutex_unlock (&pf->lock);
+      if (done)
+        break;
+
+      /* Take the next name from the directory that is behind.  */
+      f = (! pf->names[0][fetched[0]]
+           || (pf->names[1][fetched[1]] && fetched[1] < fetched[0]));
+      if (! pf->names[f][fetched[f]])
+        break;
+      prefetch_file (pf->dir[f], pf->names[f][fetched[f]++]);
+    }
+
+  return NULL;
+}
+
+/* Start the prefetcher P on the null-terminated vectors NAMES of file
+   names in the directories of CMP.  Return true if it was started.  */
+
+static bool
+start_prefetcher (struct prefetcher *pf, struct comparison const *cmp,
+                  char const **const names[2])
+{
+  int f;
+
+  /* diff_dirs may reorder its names while the prefetcher runs, so
+     give the prefetcher copies.  */
+  for (f = 0; f < 2; f++)
+    {
+      size_t n = 0;
+      while (names[f][n])
+        n++;
+      pf->dir[f] = cmp->file[f].name;
+      pf->names[f] = xmemdup (names[f], (n + 1) * sizeof *names[f]);
+    }
+  pf->compared = 0;
+  pf->done = false;
+  pthread_mutex_init (&pf->lock, NULL);
+  pthread_cond_init (&pf->progress, NULL);
+  if (pthread_create (&pf->thread, NULL, prefetch_files, pf) == 0)
+    return true;
+
+  pthread_cond_destroy (&pf->progress);
+  pthread_mutex_destroy (&pf->lock);
+  for (f = 0; f < 2; f++)
+    free (pf->names[f]);
+  return false;
+}
+
+/* Tell the prefetcher P that COMPARED files have been compared, or
+   that all have if DONE.  */
+
+static void
+report_progress (struct prefetcher *pf, size_t compared, bool done)
+{
+  pthread_mutex_lock (&pf->lock);
+  pf->compared = compared;
+  pf->done = done;
+  pthread_cond_signal (&pf->progress);
+  pthread_mutex_unlock (&pf->lock);
+}
+
+/* Stop the prefetcher P and free its resources.  */
+
+static void
+stop_prefetcher (struct prefetcher *pf)
+{
+  int f;
+
+  report_progress (pf, pf->compared, true);
+  pthread_join (pf->thread, NULL);
+  pthread_cond_destroy (&pf->progress);
+  pthread_mutex_destroy (&pf->lock);
+  for (f = 0; f < 2; f++)
+    free (pf->names[f]);
+}
+#endif
+
 /* Compare the contents of two directories named in CMP.
    This is a top-level routine; it does everything necessary for diff
    on two directories.
@@ -241,10 +398,21 @@ diff_dirs (struct comparison const *cmp,
       names[0] = dirdata[0].names;
       names[1] = dirdata[1].names;
 
+#if USE_POSIX_THREADS
+      struct prefetcher pf;
+      bool volatile prefetching = false;
+#endif
+
       /* Use locale-specific sorting if possible, else native byte order.  */
       locale_specific_sorting = true;
       if (setjmp (failed_locale_specific_sorting))
-        locale_specific_sorting = false;
+        {
+          locale_specific_sorting = false;
+#if USE_POSIX_THREADS
+          if (prefetching)
+            stop_prefetcher (&pf);
+#endif
+        }
 
       /* Sort the directories.  */
       for (i = 0; i < 2; i++)
@@ -262,6 +430,11 @@ diff_dirs (struct comparison const *cmp,
             names[1]++;
         }
 
+#if USE_POSIX_THREADS
+      char const **first[2] = { names[0], names[1] };
+      prefetching = prefetch && start_prefetcher (&pf, cmp, first);
+#endif
+
       /* Loop while files remain in one or both dirs.  */
       while (*names[0] || *names[1])
         {
@@ -310,7 +483,18 @@ diff_dirs (struct comparison const *cmp,
                                    nameorder < 0 ? 0 : *names[1]++);
           if (val < v1)
             val = v1;
+
+#if USE_POSIX_THREADS
+          if (prefetching)
+            report_progress (&pf, ((names[0] - first[0])
+                                   + (names[1] - first[1])), false);
+#endif
         }
+
+#if USE_POSIX_THREADS
+      if (prefetching)
+        stop_prefetcher (&pf);
+#endif
     }
 
   for (i = 0; i < 2; i++)
@@ -51,8 +51,9 @@ print_ifdef_script (struct change *script)
 {
   next_line0 = next_line1 = - files[0].prefix_lines;
   print_script (script, find_change, print_ifdef_hunk);
-  if (next_line0 < files[0].valid_lines
-      || next_line1 < files[1].valid_lines)
+  if ((next_line0 < files[0].valid_lines
+       || next_line1 < files[1].valid_lines)
+      && ! hunk_limit_reached ())
     {
       begin_output ();
       format_ifdef (group_format[UNCHANGED],
@@ -22,48 +22,226 @@
 #include <binary-io.h>
 #include <cmpbuf.h>
 #include <file-type.h>
+#include <ignore-value.h>
+#include <progname.h>
+#include <timespec.h>
 #include <xalloc.h>
 
-/* Rotate an unsigned value to the left.  */
-#define ROL(v, n) ((v) << (n) | (v) >> (sizeof (v) * CHAR_BIT - (n)))
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
+
+#if HAVE_SYS_MMAN_H && HAVE_MAP_ANONYMOUS
+# include <sys/mman.h>
+# define MMAP_INPUT 1
+#else
+# define MMAP_INPUT 0
+#endif
+
+/* Regular files at least this large are mapped into memory rather
+   than read, so that their pages are shared with the page cache and
+   pages that are never examined are never read.  */
+enum { MMAP_THRESHOLD = 256 * 1024 };
 
-/* Given a hash value and a new character, return a new hash value.  */
-#define HASH(h, c) ((c) + ROL (h, 7))
-
-/* The type of a hash value.  */
-typedef size_t hash_value;
 verify (! TYPE_SIGNED (hash_value));
 
 /* Lines are put into equivalence classes of lines that match in lines_differ.
-   Each equivalence class is represented by one of these structures,
-   but only while the classes are being computed.
-   Afterward, each class is represented by a number.  */
-struct equivclass
+   Each equivalence class is represented by a number, and while the
+   classes are being computed it is found through an open-addressing
+   hash table with linear probing.  A slot holds the class's hash and
+   number inline, so that looking up a line usually touches a single
+   cache line; the line length is mixed into the hash, so a full hash
+   match almost always means the lines are equal.  */
+struct eqslot
 {
-  lin next;		/* Next item in this bucket.  */
   hash_value hash;	/* Hash of lines in this class.  */
-  char const *line;	/* A line that fits this class.  */
-  size_t length;	/* That line's length, not counting its newline.  */
+  lin class;		/* Number of this class, or 0 if the slot is empty.  */
+};
+
+/* A line that fits an equivalence class, indexed by class number.  */
+struct eqline
+{
+  char const *line;	/* Start of the line.  */
+  size_t length;	/* The line's length, not counting its newline.  */
 };
 
-/* Hash-table: array of buckets, each being a chain of equivalence classes.
-   buckets[-1] is reserved for incomplete lines.  */
-static lin *buckets;
+/* The hash table.  Its size is a power of two, and it is grown when
+   more than 2/3 of its slots are in use.  */
+static struct eqslot *slots;
 
-/* Number of buckets in the hash table array, not counting buckets[-1].  */
-static size_t nbuckets;
+/* One less than the number of slots in the hash table.  */
+static size_t slots_mask;
 
-/* Array in which the equivalence classes are allocated.
-   The bucket-chains go through the elements in this array.
-   The number of an equivalence class is its index in this array.  */
-static struct equivclass *equivs;
+/* A tiny table reserved for incomplete lines.  It is separate from the
+   main table so that an incomplete line can compare equal only to the
+   other file's incomplete line (if one exists).  */
+static struct eqslot incomplete_slots[4];
 
-/* Index of first free element in the array 'equivs'.  */
+/* Array in which the lines of the equivalence classes are recorded.
+   Element 0 is unused.  */
+static struct eqline *eqlines;
+
+/* Index of first free element in the array 'eqlines', i.e., the number
+   of the next equivalence class.  */
 static lin equivs_index;
 
-/* Number of elements allocated in the array 'equivs'.  */
+/* Number of elements allocated in the array 'eqlines'.  */
 static lin equivs_alloc;
-
+
+/* Return true if a hash table with MASK + 1 slots needs to grow
+   before it holds CLASSES equivalence classes.  */
+static bool
+slots_too_full (size_t mask, lin classes)
+{
+  return mask / 3 * 2 < (size_t) classes;
+}
+
+/* Double the size of the hash table *PSLOTS with *PMASK + 1 slots,
+   rehashing its slots.  */
+static void
+grow_slots (struct eqslot **pslots, size_t *pmask)
+{
+  size_t old_mask = *pmask;
+  struct eqslot *old = *pslots;
+  size_t i, mask;
+  struct eqslot *new;
+
+  if (PTRDIFF_MAX / (2 * sizeof *new) <= old_mask + 1)
+    xalloc_die ();
+  mask = 2 * old_mask + 1;
+  new = zalloc ((mask + 1) * sizeof *new);
+
+  for (i = 0; i <= old_mask; i++)
+    if (old[i].class)
+      {
+        size_t j = old[i].hash & mask;
+        while (new[j].class)
+          j = (j + 1) & mask;
+        new[j] = old[i];
+      }
+  free (old);
+  *pslots = new;
+  *pmask = mask;
+}
+
+/* The canonical forms (see canon_line) of the lines of equivalence
+   classes.  A class's form is built the second time a line with the
+   same hash does not match the class's line exactly, so that whether
+   such lines fit the class is decided by comparing canonical forms,
+   without normalizing the class's line for each of them.  A line that
+   is compared only once is compared with lines_differ, which is faster
+   than building a form that is never used again.  Each form follows its
+   length in FORMS.  */
+struct canon_cache
+{
+  char *forms;		/* Canonical forms of class lines.  */
+  size_t used;		/* Number of bytes used in FORMS.  */
+  size_t alloc;		/* Number of bytes allocated for FORMS.  */
+  size_t *form;		/* By class, 2 + offset in FORMS, or the
+                           number of times compared if less than 2.  */
+  lin classes;		/* Number of elements allocated in FORM.  */
+  char *line;		/* Canonical form of the line being classified.  */
+  size_t line_alloc;	/* Number of bytes allocated for LINE.  */
+  intmax_t built;	/* Number of forms built.  */
+};
+
+/* The cache for the classes in 'eqlines'.  */
+static struct canon_cache canon;
+
+/* Free the storage of the cache CC and make it empty, counting the
+   forms it built in the statistics.  */
+static void
+free_canon (struct canon_cache *cc)
+{
+  stats.canonical_forms += cc->built;
+  free (cc->forms);
+  free (cc->form);
+  free (cc->line);
+  memset (cc, 0, sizeof *cc);
+}
+
+/* Return the canonical form of the line of class I in EQS, using the
+   cache CC, and set *PLENGTH to its length.  Return NULL instead if
+   this is the first time the form is wanted.  */
+static char const *
+class_form (struct canon_cache *cc, struct eqline const *eqs, lin i,
+            size_t *plength)
+{
+  if (cc->classes <= i)
+    {
+      lin classes = MAX (i + 1, 2 * cc->classes);
+      cc->form = xnrealloc (cc->form, classes, sizeof *cc->form);
+      memset (cc->form + cc->classes, 0,
+              (classes - cc->classes) * sizeof *cc->form);
+      cc->classes = classes;
+    }
+  if (! cc->form[i])
+    {
+      cc->form[i] = 1;
+      return NULL;
+    }
+  if (cc->form[i] == 1)
+    {
+      size_t length = eqs[i].length;
+      if (cc->alloc - cc->used < sizeof length + length)
+        {
+          if (SIZE_MAX / 2 - sizeof length < cc->alloc + length)
+            xalloc_die ();
+          cc->alloc = MAX (2 * cc->alloc, cc->used + sizeof length + length);
+          cc->forms = xrealloc (cc->forms, cc->alloc);
+        }
+      char *f = cc->forms + cc->used;
+      length = canon_line (eqs[i].line, length, f + sizeof length);
+      memcpy (f, &length, sizeof length);
+      cc->form[i] = cc->used + 2;
+      cc->used += sizeof length + length;
+      cc->built++;
+    }
+  char const *f = cc->forms + cc->form[i] - 2;
+  memcpy (plength, f, sizeof *plength);
+  return f + sizeof *plength;
+}
+
+/* Return true if the line IP of length LENGTH, whose hash equals that
+   of the equivalence class I in EQS, belongs to that class.  CC caches
+   the canonical forms of the classes' lines.  */
+static bool
+line_fits_class (struct eqline const *eqs, lin i, char const *ip,
+                 size_t length, struct canon_cache *cc)
+{
+  struct eqline const *eq = &eqs[i];
+  if (eq->length == length)
+    {
+      /* Reuse existing equivalence class if the lines are identical.
+         This detects the common case of exact identity faster than
+         lines_differ would.  */
+      if (memcmp (eq->line, ip, length) == 0)
+        return true;
+      if (! (ignore_white_space != IGNORE_NO_WHITE_SPACE || ignore_case))
+        return false;
+    }
+  else if (ignore_white_space == IGNORE_NO_WHITE_SPACE)
+    return false;
+
+  size_t form_length;
+  char const *form = canon_line ? class_form (cc, eqs, i, &form_length) : NULL;
+  if (form)
+    {
+      /* Reuse existing class if the canonical forms are equal.  */
+      if (cc->line_alloc < length)
+        {
+          free (cc->line);
+          cc->line_alloc = MAX (length, 2 * cc->line_alloc);
+          cc->line = xmalloc (cc->line_alloc);
+        }
+      return (canon_line (ip, length, cc->line) == form_length
+              && memcmp (cc->line, form, form_length) == 0);
+    }
+
+  /* Reuse existing class if lines_differ reports the lines equal.  */
+  return ! lines_differ (eq->line, ip);
+}
+
 /* Read a block of data into a file buffer, checking for EOF and error.  */
 
 void
@@ -145,6 +323,139 @@ sip (struct file_data *current, bool skip_test)
   return false;
 }
 
+#if MMAP_INPUT
+/* The files being read by read_files, some of which may be mapped.  */
+static struct file_data const *mapped_files;
+
+/* The message to output if a mapped file shrinks, translated in
+   advance, since the signal handler cannot call gettext.  */
+static char const *shrunk_message;
+
+/* Write S to standard error from a signal handler.  */
+
+static void
+write_stderr (char const *s)
+{
+  ignore_value (write (STDERR_FILENO, s, strlen (s)));
+}
+
+/* Handle SIGBUS, which a file raises if it shrinks after it is mapped
+   and its lost pages are then examined.  Report that the file changed,
+   as reading it would, and exit.  */
+
+static void
+bus_error (int sig, siginfo_t *info, void *ucontext)
+{
+  char const *addr = info->si_addr;
+  struct file_data const *fv = mapped_files;
+  int f;
+
+  if (fv)
+    for (f = 0; f < 2; f++)
+      {
+        char const *buf = (char const *) fv[f].buffer;
+        if (fv[f].mapped && buf <= addr && addr < buf + fv[f].bufsize)
+          {
+            write_stderr (program_name);
+            write_stderr (": ");
+            write_stderr (fv[f].name);
+            write_stderr (": ");
+            write_stderr (shrunk_message);
+            write_stderr ("\n");
+            _exit (EXIT_TROUBLE);
+          }
+      }
+
+  /* Some other bus error; let it take its course.  */
+  signal (sig, SIG_DFL);
+}
+
+/* Catch SIGBUS, if that has not been done already.  This is called
+   only by the main thread, before any reader thread starts.  */
+
+static void
+catch_bus_error (void)
+{
+  static bool caught;
+  if (! caught)
+    {
+      struct sigaction act;
+      shrunk_message = _("file shrank while being compared");
+      sigemptyset (&act.sa_mask);
+      act.sa_flags = SA_SIGINFO;
+      act.sa_sigaction = bus_error;
+      sigaction (SIGBUS, &act, NULL);
+      caught = true;
+    }
+}
+
+/* Try to map the regular file CURRENT, which has FILE_SIZE bytes
+   starting where sip began reading, into private memory followed by
+   room for the appended newline and word sentinels.  The mapping is
+   copy-on-write, so planting sentinels dirties only its last pages.
+   Return true if successful.  Otherwise leave CURRENT alone, so that
+   the caller can read the file instead.  */
+
+static bool
+map_file (struct file_data *current, size_t file_size)
+{
+  static size_t pagesize;
+  if (! pagesize)
+    pagesize = sysconf (_SC_PAGESIZE);
+
+  off_t pos = lseek (current->desc, 0, SEEK_CUR);
+  if (pos < 0)
+    return false;
+  off_t start = pos - current->buffered;
+  if (start % pagesize != 0)
+    return false;
+
+  /* Leave a file whose size has changed since it was statted to the
+     read loop, which notices bytes appended since then and reads
+     only the bytes that are left.  If the file shrinks after it is
+     mapped, bus_error reports it.  */
+  char c;
+  if (file_size == 0
+      || pread (current->desc, &c, 1, start + file_size - 1) != 1
+      || pread (current->desc, &c, 1, start + file_size) != 0)
+    return false;
+
+  size_t mapsize = file_size - file_size % pagesize + 2 * pagesize;
+  if (mapsize < file_size || PTRDIFF_MAX <= mapsize)
+    return false;
+
+  /* Reserve the whole range anonymously, then map the file over its
+     start, so that the sentinel room past the end of file is
+     ordinary zeroed memory.  */
+  void *base = mmap (NULL, mapsize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+  if (mmap (base, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            current->desc, start)
+      == MAP_FAILED)
+    {
+      munmap (base, mapsize);
+      return false;
+    }
+
+#ifdef MADV_WILLNEED
+  /* With --threads, have the kernel start reading the whole file now,
+     so that its I/O overlaps the work on the other file.  */
+  if (1 < threads)
+    madvise (base, file_size, MADV_WILLNEED);
+#endif
+
+  free (current->buffer);
+  current->buffer = base;
+  current->bufsize = mapsize;
+  current->buffered = file_size;
+  current->eof = true;
+  current->mapped = true;
+  return true;
+}
+#endif
+
 /* Slurp the rest of the current file completely into memory.  */
 
 static void
@@ -171,6 +482,14 @@ slurp (struct file_data *current)
           || PTRDIFF_MAX <= cc)
         xalloc_die ();
 
+#if MMAP_INPUT
+      /* --strip-trailing-cr compacts the text in place, but leaves the
+         bytes before the first CRLF alone, so with a copy-on-write
+         mapping only the pages from there on become private copies.  */
+      if (MMAP_THRESHOLD <= file_size && map_file (current, file_size))
+        return;
+#endif
+
       if (current->bufsize < cc)
         {
           current->bufsize = cc;
@@ -213,6 +532,72 @@ slurp (struct file_data *current)
     }
 }
 
+/* Like xrealloc (P, SIZE), for a line table or equivalence class table
+   of which the first OLD_SIZE bytes are in use.  Count those bytes for
+   ---stats, as realloc may have to copy them.  */
+
+static void *
+grow_table (void *p, size_t old_size, size_t size)
+{
+  stats.table_bytes_reallocated += old_size;
+  return xrealloc (p, size);
+}
+
+/* Record the starts of the lines of CURRENT's suffix that we care
+   about, starting with line number LINE at P.  Record one more line
+   start than lines, so that we can compute the length of any buffered
+   line.  */
+
+static void
+find_suffix_lines (struct file_data *current, lin line, char const *p)
+{
+  char const **linbuf = current->linbuf;
+  lin alloc_lines = current->alloc_lines;
+  lin linbuf_base = current->linbuf_base;
+  char const *bufend = FILE_BUFFER (current) + current->buffered;
+  lin i;
+
+  for (i = 0;  ;  i++)
+    {
+      if (line == alloc_lines)
+        {
+          /* Double (alloc_lines - linbuf_base) by adding to alloc_lines.  */
+          if (PTRDIFF_MAX / 3 <= alloc_lines
+              || PTRDIFF_MAX / sizeof (lin) <= 2 * alloc_lines - linbuf_base
+              || PTRDIFF_MAX / sizeof *linbuf <= alloc_lines - linbuf_base)
+            xalloc_die ();
+          lin old_lines = alloc_lines - linbuf_base;
+          alloc_lines = 2 * alloc_lines - linbuf_base;
+          linbuf += linbuf_base;
+          linbuf = grow_table (linbuf, old_lines * sizeof *linbuf,
+                               (alloc_lines - linbuf_base) * sizeof *linbuf);
+          linbuf -= linbuf_base;
+        }
+      linbuf[line] = p;
+
+      if (p == bufend)
+        {
+          /* If the last line is incomplete and we do not silently
+             complete lines, don't count its appended newline.  */
+          if (current->missing_newline && ROBUST_OUTPUT_STYLE (output_style))
+            linbuf[line]--;
+          break;
+        }
+
+      if (context <= i && no_diff_means_no_output)
+        break;
+
+      line++;
+
+      while (*p++ != '\n')
+        continue;
+    }
+
+  current->linbuf = linbuf;
+  current->valid_lines = line;
+  current->alloc_lines = alloc_lines;
+}
+
 /* Split the file into lines, simultaneously computing the equivalence
    class for each line.  */
 
@@ -220,8 +605,8 @@ static void
 find_and_hash_each_line (struct file_data *current)
 {
   char const *p = current->prefix_end;
-  lin i, *bucket;
-  size_t length;
+  lin i;
+  size_t j, length;
 
   /* Cache often-used quantities in local variables to help the compiler.  */
   char const **linbuf = current->linbuf;
@@ -229,121 +614,24 @@ find_and_hash_each_line (struct file_data *current)
   lin line = 0;
   lin linbuf_base = current->linbuf_base;
   lin *cureqs = xmalloc (alloc_lines * sizeof *cureqs);
-  struct equivclass *eqs = equivs;
+  struct eqline *eqs = eqlines;
   lin eqs_index = equivs_index;
   lin eqs_alloc = equivs_alloc;
   char const *suffix_begin = current->suffix_begin;
   char const *bufend = FILE_BUFFER (current) + current->buffered;
-  bool ig_case = ignore_case;
-  enum DIFF_white_space ig_white_space = ignore_white_space;
-  bool diff_length_compare_anyway =
-    ig_white_space != IGNORE_NO_WHITE_SPACE;
-  bool same_length_diff_contents_compare_anyway =
-    diff_length_compare_anyway | ig_case;
+  intmax_t hash_collisions = 0;
+  intmax_t probe_collisions = 0;
 
   while (p < suffix_begin)
     {
       char const *ip = p;
-      hash_value h = 0;
-      unsigned char c;
+      hash_value h;
+      struct eqslot *table = slots;
+      size_t mask = slots_mask;
 
       /* Hash this line until we find a newline.  */
-      switch (ig_white_space)
-        {
-        case IGNORE_ALL_SPACE:
-          while ((c = *p++) != '\n')
-            if (! isspace (c))
-              h = HASH (h, ig_case ? tolower (c) : c);
-          break;
-
-        case IGNORE_SPACE_CHANGE:
-          while ((c = *p++) != '\n')
-            {
-              if (isspace (c))
-                {
-                  do
-                    if ((c = *p++) == '\n')
-                      goto hashing_done;
-                  while (isspace (c));
-
-                  h = HASH (h, ' ');
-                }
+      p = hash_line (p, &h);
 
-              /* C is now the first non-space.  */
-              h = HASH (h, ig_case ? tolower (c) : c);
-            }
-          break;
-
-        case IGNORE_TAB_EXPANSION:
-        case IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE:
-        case IGNORE_TRAILING_SPACE:
-          {
-            size_t column = 0;
-            while ((c = *p++) != '\n')
-              {
-                if (ig_white_space & IGNORE_TRAILING_SPACE
-                    && isspace (c))
-                  {
-                    char const *p1 = p;
-                    unsigned char c1;
-                    do
-                      if ((c1 = *p1++) == '\n')
-                        {
-                          p = p1;
-                          goto hashing_done;
-                        }
-                    while (isspace (c1));
-                  }
-
-                size_t repetitions = 1;
-
-                if (ig_white_space & IGNORE_TAB_EXPANSION)
-                  switch (c)
-                    {
-                    case '\b':
-                      column -= 0 < column;
-                      break;
-
-                    case '\t':
-                      c = ' ';
-                      repetitions = tabsize - column % tabsize;
-                      column = (column + repetitions < column
-                                ? 0
-                                : column + repetitions);
-                      break;
-
-                    case '\r':
-                      column = 0;
-                      break;
-
-                    default:
-                      column++;
-                      break;
-                    }
-
-                if (ig_case)
-                  c = tolower (c);
-
-                do
-                  h = HASH (h, c);
-                while (--repetitions != 0);
-              }
-          }
-          break;
-
-        default:
-          if (ig_case)
-            while ((c = *p++) != '\n')
-              h = HASH (h, tolower (c));
-          else
-            while ((c = *p++) != '\n')
-              h = HASH (h, c);
-          break;
-        }
-
-   hashing_done:;
-
-      bucket = &buckets[h % nbuckets];
       length = p - ip - 1;
 
       if (p == bufend
@@ -352,54 +640,49 @@ find_and_hash_each_line (struct file_data *current)
         {
           /* The last line is incomplete and we do not silently
              complete lines.  If the line cannot compare equal to any
-             complete line, put it into buckets[-1] so that it can
-             compare equal only to the other file's incomplete line
-             (if one exists).  */
-          if (ig_white_space < IGNORE_TRAILING_SPACE)
-            bucket = &buckets[-1];
+             complete line, put it into the table of incomplete lines
+             so that it can compare equal only to the other file's
+             incomplete line (if one exists).  */
+          if (ignore_white_space < IGNORE_TRAILING_SPACE)
+            {
+              table = incomplete_slots;
+              mask = sizeof incomplete_slots / sizeof *incomplete_slots - 1;
+            }
         }
 
-      for (i = *bucket;  ;  i = eqs[i].next)
-        if (!i)
-          {
-            /* Create a new equivalence class in this bucket.  */
-            i = eqs_index++;
-            if (i == eqs_alloc)
-              {
-                if (PTRDIFF_MAX / (2 * sizeof *eqs) <= eqs_alloc)
-                  xalloc_die ();
-                eqs_alloc *= 2;
-                eqs = xrealloc (eqs, eqs_alloc * sizeof *eqs);
-              }
-            eqs[i].next = *bucket;
-            eqs[i].hash = h;
-            eqs[i].line = ip;
-            eqs[i].length = length;
-            *bucket = i;
-            break;
-          }
-        else if (eqs[i].hash == h)
-          {
-            char const *eqline = eqs[i].line;
-
-            /* Reuse existing class if lines_differ reports the lines
-               equal.  */
-            if (eqs[i].length == length)
-              {
-                /* Reuse existing equivalence class if the lines are identical.
-                   This detects the common case of exact identity
-                   faster than lines_differ would.  */
-                if (memcmp (eqline, ip, length) == 0)
-                  break;
-                if (!same_length_diff_contents_compare_anyway)
-                  continue;
-              }
-            else if (!diff_length_compare_anyway)
-              continue;
-
-            if (! lines_differ (eqline, ip))
+      for (j = h & mask;  ;  j = (j + 1) & mask)
+        {
+          struct eqslot *slot = &table[j];
+          i = slot->class;
+          if (!i)
+            {
+              /* Create a new equivalence class in this slot.  */
+              i = eqs_index++;
+              if (i == eqs_alloc)
+                {
+                  if (PTRDIFF_MAX / (2 * sizeof *eqs) <= eqs_alloc)
+                    xalloc_die ();
+                  eqs = grow_table (eqs, eqs_alloc * sizeof *eqs,
+                                    2 * eqs_alloc * sizeof *eqs);
+                  eqs_alloc *= 2;
+                }
+              eqs[i].line = ip;
+              eqs[i].length = length;
+              slot->hash = h;
+              slot->class = i;
+              if (slots_too_full (slots_mask, eqs_index))
+                grow_slots (&slots, &slots_mask);
               break;
-          }
+            }
+          else if (slot->hash == h)
+            {
+              if (line_fits_class (eqs, i, ip, length, &canon))
+                break;
+              hash_collisions++;
+            }
+          else
+            probe_collisions++;
+        }
 
       /* Maybe increase the size of the line table.  */
       if (line == alloc_lines)
@@ -409,11 +692,14 @@ find_and_hash_each_line (struct file_data *current)
               || PTRDIFF_MAX / sizeof *cureqs <= 2 * alloc_lines - linbuf_base
               || PTRDIFF_MAX / sizeof *linbuf <= alloc_lines - linbuf_base)
             xalloc_die ();
+          lin old_lines = alloc_lines - linbuf_base;
+          cureqs = grow_table (cureqs, line * sizeof *cureqs,
+                               (2 * alloc_lines - linbuf_base)
+                               * sizeof *cureqs);
           alloc_lines = 2 * alloc_lines - linbuf_base;
-          cureqs = xrealloc (cureqs, alloc_lines * sizeof *cureqs);
           linbuf += linbuf_base;
-          linbuf = xrealloc (linbuf,
-                             (alloc_lines - linbuf_base) * sizeof *linbuf);
+          linbuf = grow_table (linbuf, old_lines * sizeof *linbuf,
+                               (alloc_lines - linbuf_base) * sizeof *linbuf);
           linbuf -= linbuf_base;
         }
       linbuf[line] = ip;
@@ -422,172 +708,554 @@ find_and_hash_each_line (struct file_data *current)
     }
 
   current->buffered_lines = line;
-
-  for (i = 0;  ;  i++)
-    {
-      /* Record the line start for lines in the suffix that we care about.
-         Record one more line start than lines,
-         so that we can compute the length of any buffered line.  */
-      if (line == alloc_lines)
-        {
-          /* Double (alloc_lines - linbuf_base) by adding to alloc_lines.  */
-          if (PTRDIFF_MAX / 3 <= alloc_lines
-              || PTRDIFF_MAX / sizeof *cureqs <= 2 * alloc_lines - linbuf_base
-              || PTRDIFF_MAX / sizeof *linbuf <= alloc_lines - linbuf_base)
-            xalloc_die ();
-          alloc_lines = 2 * alloc_lines - linbuf_base;
-          linbuf += linbuf_base;
-          linbuf = xrealloc (linbuf,
-                             (alloc_lines - linbuf_base) * sizeof *linbuf);
-          linbuf -= linbuf_base;
-        }
-      linbuf[line] = p;
-
-      if (p == bufend)
-        {
-          /* If the last line is incomplete and we do not silently
-             complete lines, don't count its appended newline.  */
-          if (current->missing_newline && ROBUST_OUTPUT_STYLE (output_style))
-            linbuf[line]--;
-          break;
-        }
-
-      if (context <= i && no_diff_means_no_output)
-        break;
-
-      line++;
-
-      while (*p++ != '\n')
-        continue;
-    }
+  stats.lines_hashed += line;
+  stats.hash_collisions += hash_collisions;
+  stats.probe_collisions += probe_collisions;
 
   /* Done with cache in local variables.  */
   current->linbuf = linbuf;
-  current->valid_lines = line;
   current->alloc_lines = alloc_lines;
   current->equivs = cureqs;
-  equivs = eqs;
+  eqlines = eqs;
   equivs_alloc = eqs_alloc;
   equivs_index = eqs_index;
+
+  find_suffix_lines (current, line, p);
 }
-
-/* Prepare the text.  Make sure the text end is initialized.
-   Make sure text ends in a newline,
-   but remember that we had to add one.
-   Strip trailing CRs, if that was requested.  */
 
-static void
-prepare_text (struct file_data *current)
+#if USE_POSIX_THREADS
+
+/* With --threads, inputs with at least this many lines (as counted
+   by find_identical_ends) to hash are hashed in parallel.  Smaller inputs are
+   not worth starting threads for.  */
+enum { PARALLEL_MIN_LINES = 64 * 1024 };
+
+/* Hashing in parallel has two phases.  First, the part of each file
+   between its common prefix and suffix is split at line boundaries
+   into chunks, one per thread, and each chunk is split into lines and
+   each line is hashed, into arrays local to the chunk.  The chunks of
+   each file are then concatenated.  Second, the lines are put into
+   equivalence classes.  For this the hash table is split into shards
+   by the top bits of the hash, each thread owns some of the shards,
+   and every thread walks the lines of both files in order, classifying
+   the lines that hash into its shards.  All lines of a class have the
+   same hash and so are in the same shard, and each shard sees them in
+   the same order as find_and_hash_each_line would; so the classes are
+   the same as in the serial case, although they are numbered
+   differently.  Finally each shard's class numbers are offset by the
+   number of classes in the shards before it.  */
+
+/* A chunk of a file being split into lines and hashed.  */
+struct hash_chunk
 {
-  size_t buffered = current->buffered;
-  char *p = FILE_BUFFER (current);
-  if (!p)
-    return;
-
-  if (strip_trailing_cr)
-    {
-      char *srclim = p + buffered;
-      *srclim = '\r';
-      char *dst = rawmemchr (p, '\r');
+  /* The chunk's text.  It starts at the start of a line and ends just
+     after a newline, or at the file's suffix.  */
+  char const *begin;
+  char const *end;
+
+  /* The start and the hash of each line in the chunk, and their number.  */
+  char const **lines;
+  hash_value *hashes;
+  lin n;
+};
 
-      for (char const *src = dst; src != srclim; src++)
-        {
-          src += *src == '\r' && src[1] == '\n';
-          *dst++ = *src;
-        }
+/* A file whose lines are being hashed.  */
+struct hashed_file
+{
+  struct file_data *file;
 
-      buffered -= srclim - dst;
-    }
+  /* The hash of each line.  */
+  hash_value *hashes;
 
-  if (buffered != 0 && p[buffered - 1] != '\n')
-    {
-      p[buffered++] = '\n';
-      current->missing_newline = true;
-    }
+  /* The number of lines hashed, and the end of the last one.  */
+  lin lines;
+  char const *end;
 
-  /* Don't use uninitialized storage when planting or using sentinels.  */
-  memset (p + buffered, 0, sizeof (word));
+  /* The number of the line that is an incomplete line that can match
+     only the other file's incomplete line, or -1 if there is none.  */
+  lin incomplete;
+};
 
-  current->buffered = buffered;
-}
-
-/* We have found N lines in a buffer of size S; guess the
-   proportionate number of lines that will be found in a buffer of
-   size T.  However, do not guess a number of lines so large that the
-   resulting line table might cause overflow in size calculations.  */
-static lin
-guess_lines (lin n, size_t s, size_t t)
+/* A shard of the equivalence class table, or the table of incomplete
+   lines.  Its classes are numbered from 1.  */
+struct shard
 {
-  size_t guessed_bytes_per_line = n < 10 ? 32 : s / (n - 1);
-  lin guessed_lines = MAX (1, t / guessed_bytes_per_line);
-  return MIN (guessed_lines, PTRDIFF_MAX / (2 * sizeof (char *) + 1) - 5) + 5;
-}
+  struct eqslot *slots;
+  size_t mask;
+  struct eqline *eqs;
+  lin classes;
+  lin alloc;
+  intmax_t hash_collisions;
+  intmax_t probe_collisions;
+  struct canon_cache canon;
+};
 
-/* Given a vector of two file_data objects, find the identical
-   prefixes and suffixes of each object.  */
+/* The state shared by the threads classifying lines.  */
+struct classify_job
+{
+  struct hashed_file *files;
+  struct shard *shards;
+  int shard_bits;
+  int threads;
+};
 
-static void
-find_identical_ends (struct file_data filevec[])
+/* A thread classifying lines, and the shards that it owns.  */
+struct classifier
 {
-  word *w0, *w1;
-  char *p0, *p1, *buffer0, *buffer1;
-  char const *end0, *beg0;
-  char const **linbuf0, **linbuf1;
-  lin i, lines;
-  size_t n0, n1;
-  lin alloc_lines0, alloc_lines1;
-  bool prefix_needed;
-  lin buffered_prefix, prefix_count, prefix_mask;
-  lin middle_guess, suffix_guess;
+  struct classify_job *job;
+  int thread;
+};
 
-  slurp (&filevec[0]);
-  prepare_text (&filevec[0]);
-  if (filevec[0].desc != filevec[1].desc)
+/* Split the chunk C into lines and hash each line.  */
+
+static void *
+hash_chunk_lines (void *c_arg)
+{
+  struct hash_chunk *c = c_arg;
+  char const *p = c->begin;
+  char const *end = c->end;
+  lin alloc = p < end ? count_newlines (p, end - p) : 0;
+  char const **lines = xnmalloc (MAX (1, alloc), sizeof *lines);
+  hash_value *hashes = xnmalloc (MAX (1, alloc), sizeof *hashes);
+  lin n;
+
+  for (n = 0; p < end; n++)
     {
-      slurp (&filevec[1]);
-      prepare_text (&filevec[1]);
+      lines[n] = p;
+      p = hash_line (p, &hashes[n]);
     }
-  else
+
+  c->lines = lines;
+  c->hashes = hashes;
+  c->n = n;
+  return NULL;
+}
+
+/* Split the lines of CURRENT between its prefix and suffix into N
+   chunks at line boundaries, storing them into C.  */
+
+static void
+split_into_chunks (struct file_data const *current, struct hash_chunk *c,
+                   int n)
+{
+  char const *begin = current->prefix_end;
+  char const *end = current->suffix_begin;
+  size_t size = end < begin ? 0 : end - begin;
+  int i;
+
+  for (i = 0; i < n; i++)
     {
-      filevec[1].buffer = filevec[0].buffer;
-      filevec[1].bufsize = filevec[0].bufsize;
-      filevec[1].buffered = filevec[0].buffered;
-      filevec[1].missing_newline = filevec[0].missing_newline;
+      char const *b = i == 0 ? begin : c[i - 1].end;
+      char const *e = end;
+      if (i + 1 < n)
+        {
+          /* End the chunk after the first newline at or past its
+             share of the text, if that is before END.  */
+          char const *q = begin + size / n * (i + 1);
+          if (q < b)
+            q = b;
+          if (q < end)
+            {
+              q = (char const *) rawmemchr (q, '\n') + 1;
+              if (q < end)
+                e = q;
+            }
+        }
+      c[i].begin = b;
+      c[i].end = e;
+    }
+}
+
+/* Concatenate the N chunks C of the file of HF into its line table and
+   the array of hashes of HF, and free the chunks.  */
+
+static void
+join_chunks (struct hashed_file *hf, struct hash_chunk *c, int n)
+{
+  struct file_data *current = hf->file;
+  char const **linbuf = current->linbuf;
+  lin alloc_lines = current->alloc_lines;
+  lin linbuf_base = current->linbuf_base;
+  char const *bufend = FILE_BUFFER (current) + current->buffered;
+  hash_value *hashes;
+  lin line = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      if (PTRDIFF_MAX - c[i].n <= line)
+        xalloc_die ();
+      line += c[i].n;
+    }
+  if (alloc_lines < line)
+    {
+      if (PTRDIFF_MAX / sizeof *linbuf <= line - linbuf_base)
+        xalloc_die ();
+      lin old_lines = alloc_lines - linbuf_base;
+      alloc_lines = line;
+      linbuf += linbuf_base;
+      linbuf = grow_table (linbuf, old_lines * sizeof *linbuf,
+                           (alloc_lines - linbuf_base) * sizeof *linbuf);
+      linbuf -= linbuf_base;
+    }
+  hashes = xnmalloc (MAX (1, line), sizeof *hashes);
+
+  line = 0;
+  for (i = 0; i < n; i++)
+    {
+      memcpy (&linbuf[line], c[i].lines, c[i].n * sizeof *linbuf);
+      memcpy (&hashes[line], c[i].hashes, c[i].n * sizeof *hashes);
+      line += c[i].n;
+      free (c[i].lines);
+      free (c[i].hashes);
+    }
+
+  hf->end = n ? c[n - 1].end : current->prefix_end;
+  if (hf->end < current->prefix_end)
+    hf->end = current->prefix_end;
+  hf->incomplete = -1;
+  if (hf->end == bufend && 0 < line
+      && current->missing_newline
+      && ROBUST_OUTPUT_STYLE (output_style)
+      && ignore_white_space < IGNORE_TRAILING_SPACE)
+    hf->incomplete = line - 1;
+
+  hf->hashes = hashes;
+  hf->lines = line;
+  current->buffered_lines = line;
+  current->linbuf = linbuf;
+  current->alloc_lines = alloc_lines;
+  current->equivs = xnmalloc (MAX (1, line), sizeof *current->equivs);
+  find_suffix_lines (current, line, hf->end);
+}
+
+/* Return the class in shard SH of the line IP of length LENGTH with
+   hash H, creating a new class if no existing class fits.  */
+
+static lin
+shard_class (struct shard *sh, char const *ip, size_t length, hash_value h)
+{
+  size_t j;
+
+  for (j = h & sh->mask;  ;  j = (j + 1) & sh->mask)
+    {
+      struct eqslot *slot = &sh->slots[j];
+      lin i = slot->class;
+      if (!i)
+        {
+          i = ++sh->classes;
+          if (i == sh->alloc)
+            {
+              if (PTRDIFF_MAX / (2 * sizeof *sh->eqs) <= sh->alloc)
+                xalloc_die ();
+              sh->alloc *= 2;
+              sh->eqs = xrealloc (sh->eqs, sh->alloc * sizeof *sh->eqs);
+            }
+          sh->eqs[i].line = ip;
+          sh->eqs[i].length = length;
+          slot->hash = h;
+          slot->class = i;
+          if (slots_too_full (sh->mask, sh->classes))
+            grow_slots (&sh->slots, &sh->mask);
+          return i;
+        }
+      else if (slot->hash == h)
+        {
+          if (line_fits_class (sh->eqs, i, ip, length, &sh->canon))
+            return i;
+          sh->hash_collisions++;
+        }
+      else
+        sh->probe_collisions++;
+    }
+}
+
+/* Return the number of the shard for hash H when there are 2**BITS
+   shards.  */
+
+static size_t
+shard_of (hash_value h, int bits)
+{
+  return h >> (sizeof h * CHAR_BIT - bits);
+}
+
+/* Classify the lines of both files that belong to the shards owned by
+   the classifier C, numbering the classes within each shard.  */
+
+static void *
+classify_lines (void *c_arg)
+{
+  struct classifier *c = c_arg;
+  struct classify_job *job = c->job;
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct hashed_file *hf = &job->files[f];
+      char const *const *linbuf = hf->file->linbuf;
+      lin *cureqs = hf->file->equivs;
+      lin line;
+
+      for (line = 0; line < hf->lines; line++)
+        {
+          hash_value h = hf->hashes[line];
+          size_t s = shard_of (h, job->shard_bits);
+          if (s % job->threads == c->thread && line != hf->incomplete)
+            {
+              char const *ip = linbuf[line];
+              char const *next = (line + 1 < hf->lines
+                                  ? linbuf[line + 1] : hf->end);
+              cureqs[line] = shard_class (&job->shards[s],
+                                          ip, next - ip - 1, h);
+            }
+        }
+    }
+  return NULL;
+}
+
+/* Initialize the shard SH for about LINES lines.  */
+
+static void
+init_shard (struct shard *sh, lin lines)
+{
+  for (sh->mask = 15; slots_too_full (sh->mask, lines); )
+    {
+      if (PTRDIFF_MAX / (2 * sizeof *sh->slots) <= sh->mask + 1)
+        xalloc_die ();
+      sh->mask = 2 * sh->mask + 1;
+    }
+  sh->slots = zalloc ((sh->mask + 1) * sizeof *sh->slots);
+  sh->alloc = MIN (lines, PTRDIFF_MAX / sizeof *sh->eqs - 1) + 1;
+  sh->eqs = xmalloc (sh->alloc * sizeof *sh->eqs);
+  sh->classes = 0;
+  sh->hash_collisions = sh->probe_collisions = 0;
+  memset (&sh->canon, 0, sizeof sh->canon);
+}
+
+/* Free the storage of the shard SH.  */
+
+static void
+free_shard (struct shard *sh)
+{
+  free (sh->slots);
+  free (sh->eqs);
+  free_canon (&sh->canon);
+}
+
+/* Run START (ARG[I]) for each of the N elements of the array ARG of
+   objects of size SIZE, using one thread for each.  Run the work
+   directly if a thread cannot be created.  */
+
+void
+run_threads (void *(*start) (void *), void *arg, size_t size, int n)
+{
+  pthread_t *id = xnmalloc (n, sizeof *id);
+  bool *started = xnmalloc (n, sizeof *started);
+  char *a = arg;
+  int i;
+
+  for (i = 1; i < n; i++)
+    started[i] = pthread_create (&id[i], NULL, start, a + i * size) == 0;
+  start (a);
+  for (i = 1; i < n; i++)
+    {
+      if (started[i])
+        pthread_join (id[i], NULL);
+      else
+        start (a + i * size);
+    }
+  free (started);
+  free (id);
+}
+
+/* Like find_and_hash_each_line on each file of FILEVEC, which have
+   LINES lines to hash in all, but in parallel, using up to THREADS
+   threads.  Set the files' equiv_max.  */
+
+static void
+hash_files_in_parallel (struct file_data filevec[], lin lines)
+{
+  struct hashed_file hashed[2];
+  struct hash_chunk *chunks;
+  size_t size[2];
+  int nchunks[2];
+  struct classify_job job;
+  struct classifier *classifiers;
+  struct shard incomplete;
+  lin *offset;
+  lin total;
+  size_t nshards, s;
+  int f;
+
+  /* Phase 1: split each file into chunks, giving each file a share
+     of the threads in proportion to its size, and hash the chunks.  */
+  for (f = 0; f < 2; f++)
+    {
+      char const *b = filevec[f].prefix_end;
+      char const *e = filevec[f].suffix_begin;
+      hashed[f].file = &filevec[f];
+      size[f] = b < e ? e - b : 0;
+    }
+  nchunks[0] = threads * (size[0] / ((double) size[0] + size[1] + 1)) + 0.5;
+  nchunks[0] = MAX (1, MIN (nchunks[0], threads - 1));
+  nchunks[1] = threads - nchunks[0];
+  chunks = xnmalloc (threads, sizeof *chunks);
+  split_into_chunks (&filevec[0], chunks, nchunks[0]);
+  split_into_chunks (&filevec[1], chunks + nchunks[0], nchunks[1]);
+  run_threads (hash_chunk_lines, chunks, sizeof *chunks, threads);
+  join_chunks (&hashed[0], chunks, nchunks[0]);
+  join_chunks (&hashed[1], chunks + nchunks[0], nchunks[1]);
+  free (chunks);
+
+  /* Phase 2: classify the lines, shard by shard.  Use several shards
+     per thread so that the work is spread evenly.  */
+  job.files = hashed;
+  job.threads = threads;
+  for (job.shard_bits = 1;
+       ((size_t) 1 << job.shard_bits) < 4 * (size_t) threads;
+       job.shard_bits++)
+    continue;
+  nshards = (size_t) 1 << job.shard_bits;
+  job.shards = xnmalloc (nshards, sizeof *job.shards);
+  for (s = 0; s < nshards; s++)
+    init_shard (&job.shards[s], lines / nshards);
+  classifiers = xnmalloc (threads, sizeof *classifiers);
+  for (f = 0; f < threads; f++)
+    {
+      classifiers[f].job = &job;
+      classifiers[f].thread = f;
+    }
+  run_threads (classify_lines, classifiers, sizeof *classifiers, threads);
+  free (classifiers);
+
+  /* Incomplete lines can match only each other.  There are at most two
+     of them, so classify them here.  */
+  init_shard (&incomplete, 2);
+  for (f = 0; f < 2; f++)
+    if (0 <= hashed[f].incomplete)
+      {
+        lin line = hashed[f].incomplete;
+        char const *ip = filevec[f].linbuf[line];
+        filevec[f].equivs[line]
+          = shard_class (&incomplete, ip, hashed[f].end - ip - 1,
+                         hashed[f].hashes[line]);
+      }
+
+  /* Renumber the classes so that they are distinct across shards.
+     Real equivalence classes start at 1, as in the serial case.  */
+  offset = xnmalloc (nshards, sizeof *offset);
+  total = 0;
+  for (s = 0; s < nshards; s++)
+    {
+      offset[s] = total;
+      total += job.shards[s].classes;
+      stats.hash_collisions += job.shards[s].hash_collisions;
+      stats.probe_collisions += job.shards[s].probe_collisions;
+      free_shard (&job.shards[s]);
+    }
+  for (f = 0; f < 2; f++)
+    {
+      lin *cureqs = filevec[f].equivs;
+      lin line;
+      for (line = 0; line < hashed[f].lines; line++)
+        cureqs[line] += (line == hashed[f].incomplete
+                         ? total
+                         : offset[shard_of (hashed[f].hashes[line],
+                                            job.shard_bits)]);
+      stats.lines_hashed += hashed[f].lines;
+      free (hashed[f].hashes);
+    }
+  total += incomplete.classes;
+  free_shard (&incomplete);
+  free (offset);
+  free (job.shards);
+
+  filevec[0].equiv_max = filevec[1].equiv_max = total + 1;
+}
+#endif
+
+/* Prepare the text.  Make sure the text end is initialized.
+   Make sure text ends in a newline,
+   but remember that we had to add one.
+   Strip trailing CRs, if that was requested.  */
+
+static void
+prepare_text (struct file_data *current)
+{
+  size_t buffered = current->buffered;
+  char *p = FILE_BUFFER (current);
+  if (!p)
+    return;
+
+  if (strip_trailing_cr)
+    buffered = strip_cr (p, buffered);
+
+  if (buffered != 0 && p[buffered - 1] != '\n')
+    {
+      p[buffered++] = '\n';
+      current->missing_newline = true;
     }
 
+  /* Don't use uninitialized storage when planting or using sentinels.  */
+  memset (p + buffered, 0, sizeof (word));
+
+  current->buffered = buffered;
+}
+
+/* Return the number of line starts that find_suffix_lines records
+   for the suffix of CURRENT, which begins at P.  */
+
+static lin
+count_suffix_lines (struct file_data const *current, char const *p)
+{
+  char const *bufend = FILE_BUFFER (current) + current->buffered;
+  lin n = 0;
+
+  if (! no_diff_means_no_output)
+    n = count_newlines (p, bufend - p);
+  else
+    for (; n < context && p != bufend; n++)
+      p = (char const *) rawmemchr (p, '\n') + 1;
+  if (PTRDIFF_MAX / (2 * sizeof (char *) + 1) - 5 <= n)
+    xalloc_die ();
+  return n + 1;
+}
+
+/* Given a vector of two file_data objects whose buffers hold their
+   text, find the identical prefixes and suffixes of each object.
+   Return the number of lines between them, which are to be hashed.  */
+
+static lin
+find_identical_ends (struct file_data filevec[])
+{
+  char *p0, *p1, *buffer0, *buffer1;
+  char const *end0, *beg0;
+  char const **linbuf0, **linbuf1;
+  lin i, lines;
+  size_t n0, n1;
+  lin alloc_lines[2] = { 0, 0 };
+  bool prefix_needed;
+  lin buffered_prefix, prefix_count, prefix_mask;
+  lin hashed = 0;
+  int f;
+
   /* Find identical prefix.  */
 
-  w0 = filevec[0].buffer;
-  w1 = filevec[1].buffer;
-  p0 = buffer0 = (char *) w0;
-  p1 = buffer1 = (char *) w1;
+  p0 = buffer0 = (char *) filevec[0].buffer;
+  p1 = buffer1 = (char *) filevec[1].buffer;
   n0 = filevec[0].buffered;
   n1 = filevec[1].buffered;
 
   if (p0 == p1)
-    /* The buffers are the same; sentinels won't work.  */
+    /* The buffers are the same.  */
     p0 = p1 += n1;
   else
     {
-      /* Insert end sentinels, in this case characters that are guaranteed
-         to make the equality test false, and thus terminate the loop.  */
-
-      if (n0 < n1)
-        p0[n0] = ~p1[n0];
-      else
-        p1[n1] = ~p0[n1];
-
-      /* Loop until first mismatch, or to the sentinel characters.  */
-
-      /* Compare a word at a time for speed.  */
-      while (*w0 == *w1)
-        w0++, w1++;
-
-      /* Do the last few bytes of comparison a byte at a time.  */
-      p0 = (char *) w0;
-      p1 = (char *) w1;
-      while (*p0 == *p1)
-        p0++, p1++;
+      /* Compare a vector at a time for speed, until the first mismatch
+         or the end of the shorter buffer.  */
+      size_t prefix = common_prefix (p0, p1, MIN (n0, n1));
+      p0 += prefix;
+      p1 += prefix;
 
       /* Don't mistakenly count missing newline as part of prefix.  */
       if (ROBUST_OUTPUT_STYLE (output_style)
@@ -625,15 +1293,11 @@ find_identical_ends (struct file_data filevec[])
          of the identical prefix.  */
       beg0 = filevec[0].prefix_end + (n0 < n1 ? 0 : n0 - n1);
 
-      /* Scan back until chars don't match or we reach that point.  */
-      while (p0 != beg0)
-        if (*--p0 != *--p1)
-          {
-            /* Point at the first char of the matching suffix.  */
-            ++p0, ++p1;
-            beg0 = p0;
-            break;
-          }
+      /* Scan back until chars don't match or we reach that point.
+         P0 then points at the first char of the matching suffix.  */
+      p0 -= common_suffix (p0, p1, p0 - beg0);
+      p1 = buffer1 + n1 - (end0 - p0);
+      beg0 = p0;
 
       /* Are we at a line-beginning in both files?  If not, add the rest of
          this line to the main body.  Discard up to HORIZON_LINES lines from
@@ -643,8 +1307,7 @@ find_identical_ends (struct file_data filevec[])
                             &&
                             (buffer1 == p1 || p1[-1] == '\n'));
       while (i-- && p0 != end0)
-        while (*p0++ != '\n')
-          continue;
+        p0 = (char *) rawmemchr (p0, '\n') + 1;
 
       p1 += p0 - beg0;
     }
@@ -669,58 +1332,70 @@ find_identical_ends (struct file_data filevec[])
 
   if (no_diff_means_no_output && ! function_regexp.fastmap
       && context < LIN_MAX / 4 && context < n0)
-    {
-      middle_guess = guess_lines (0, 0, p0 - filevec[0].prefix_end);
-      suffix_guess = guess_lines (0, 0, buffer0 + n0 - p0);
-      for (prefix_count = 1;  prefix_count <= context;  prefix_count *= 2)
-        continue;
-      alloc_lines0 = (prefix_count + middle_guess
-                      + MIN (context, suffix_guess));
-    }
+    for (prefix_count = 1;  prefix_count <= context;  prefix_count *= 2)
+      continue;
   else
-    {
-      prefix_count = 0;
-      alloc_lines0 = guess_lines (0, 0, n0);
-    }
+    prefix_count = 0;
 
   prefix_mask = prefix_count - 1;
-  lines = 0;
-  linbuf0 = xmalloc (alloc_lines0 * sizeof *linbuf0);
   prefix_needed = ! (no_diff_means_no_output
                      && filevec[0].prefix_end == p0
                      && filevec[1].prefix_end == p1);
+  end0 = filevec[0].prefix_end;
+  lines = prefix_needed ? count_newlines (buffer0, end0 - buffer0) : 0;
+  buffered_prefix = prefix_count && context < lines ? context : lines;
+
+  /* Count the lines exactly, so that the line tables and the table of
+     equivalence classes never need to grow.  Counting newlines is
+     cheap compared to hashing the lines.  */
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *current = &filevec[f];
+      char const *suffix_begin = current->suffix_begin;
+      lin middle = (current->prefix_end < suffix_begin
+                    ? count_newlines (current->prefix_end,
+                                      suffix_begin - current->prefix_end)
+                    : 0);
+      hashed += middle;
+      alloc_lines[f] = (buffered_prefix + middle
+                        + count_suffix_lines (current, suffix_begin));
+      if (alloc_lines[f] < middle
+          || PTRDIFF_MAX / (2 * sizeof (char *) + 1) <= alloc_lines[f])
+        xalloc_die ();
+    }
+
+  linbuf0 = xnmalloc (MAX (alloc_lines[0], prefix_count), sizeof *linbuf0);
   p0 = buffer0;
 
   /* If the prefix is needed, find the prefix lines.  */
   if (prefix_needed)
     {
-      end0 = filevec[0].prefix_end;
-      while (p0 != end0)
+      if (prefix_count)
         {
-          lin l = lines++ & prefix_mask;
-          if (l == alloc_lines0)
+          /* Only the last PREFIX_COUNT lines will be used, so find the
+             starts of the last ones by scanning backward from the end
+             of the prefix, which is at a line-beginning.  */
+          char const *q = end0;
+          for (i = lines; 0 < i && lines - i < prefix_count; i--)
             {
-              if (PTRDIFF_MAX / (2 * sizeof *linbuf0) <= alloc_lines0)
-                xalloc_die ();
-              alloc_lines0 *= 2;
-              linbuf0 = xrealloc (linbuf0, alloc_lines0 * sizeof *linbuf0);
+              do
+                q--;
+              while (p0 < q && q[-1] != '\n');
+              linbuf0[(i - 1) & prefix_mask] = q;
             }
-          linbuf0[l] = p0;
-          while (*p0++ != '\n')
-            continue;
         }
+      else
+        for (i = 0; i < lines; i++)
+          {
+            linbuf0[i] = p0;
+            p0 = (char *) rawmemchr (p0, '\n') + 1;
+          }
+      p0 = (char *) end0;
     }
-  buffered_prefix = prefix_count && context < lines ? context : lines;
 
   /* Allocate line buffer 1.  */
 
-  middle_guess = guess_lines (lines, p0 - buffer0, p1 - filevec[1].prefix_end);
-  suffix_guess = guess_lines (lines, p0 - buffer0, buffer1 + n1 - p1);
-  alloc_lines1 = buffered_prefix + middle_guess + MIN (context, suffix_guess);
-  if (alloc_lines1 < buffered_prefix
-      || PTRDIFF_MAX / sizeof *linbuf1 <= alloc_lines1)
-    xalloc_die ();
-  linbuf1 = xmalloc (alloc_lines1 * sizeof *linbuf1);
+  linbuf1 = xnmalloc (MAX (alloc_lines[1], buffered_prefix), sizeof *linbuf1);
 
   if (buffered_prefix != lines)
     {
@@ -740,36 +1415,20 @@ find_identical_ends (struct file_data filevec[])
   filevec[0].linbuf = linbuf0 + buffered_prefix;
   filevec[1].linbuf = linbuf1 + buffered_prefix;
   filevec[0].linbuf_base = filevec[1].linbuf_base = - buffered_prefix;
-  filevec[0].alloc_lines = alloc_lines0 - buffered_prefix;
-  filevec[1].alloc_lines = alloc_lines1 - buffered_prefix;
+  filevec[0].alloc_lines = alloc_lines[0] - buffered_prefix;
+  filevec[1].alloc_lines = alloc_lines[1] - buffered_prefix;
   filevec[0].prefix_lines = filevec[1].prefix_lines = lines;
+  return hashed;
 }
 
-/* If 1 < k, then (2**k - prime_offset[k]) is the largest prime less
-   than 2**k.  This table is derived from Chris K. Caldwell's list
-   <http://www.utm.edu/research/primes/lists/2small/>.  */
+/* Read the first block of each file of FILEVEC to see whether it
+   appears to be a binary file.  Return true if either file appears to
+   be binary.  If PRETEND_BINARY is true, pretend they are binary
+   regardless.  */
 
-static unsigned char const prime_offset[] =
-{
-  0, 0, 1, 1, 3, 1, 3, 1, 5, 3, 3, 9, 3, 1, 3, 19, 15, 1, 5, 1, 3, 9, 3,
-  15, 3, 39, 5, 39, 57, 3, 35, 1, 5, 9, 41, 31, 5, 25, 45, 7, 87, 21,
-  11, 57, 17, 55, 21, 115, 59, 81, 27, 129, 47, 111, 33, 55, 5, 13, 27,
-  55, 93, 1, 57, 25
-};
-
-/* Verify that this host's size_t is not too wide for the above table.  */
-
-verify (sizeof (size_t) * CHAR_BIT <= sizeof prime_offset);
-
-/* Given a vector of two file_data objects, read the file associated
-   with each one, and build the table of equivalence classes.
-   Return nonzero if either file appears to be a binary file.
-   If PRETEND_BINARY is nonzero, pretend they are binary regardless.  */
-
-bool
-read_files (struct file_data filevec[], bool pretend_binary)
+static bool
+sip_files (struct file_data filevec[], bool pretend_binary)
 {
-  int i;
   bool skip_test = text | pretend_binary;
   bool appears_binary = pretend_binary | sip (&filevec[0], skip_test);
 
@@ -785,37 +1444,410 @@ read_files (struct file_data filevec[], bool pretend_binary)
     {
       set_binary_mode (filevec[0].desc, O_BINARY);
       set_binary_mode (filevec[1].desc, O_BINARY);
-      return true;
     }
+  return appears_binary;
+}
 
-  find_identical_ends (filevec);
+/* Given a vector of two file_data objects whose buffers hold their
+   text, split the text into lines and build the table of equivalence
+   classes.  */
 
-  equivs_alloc = filevec[0].alloc_lines + filevec[1].alloc_lines + 1;
-  if (PTRDIFF_MAX / sizeof *equivs <= equivs_alloc)
+static void
+hash_files (struct file_data filevec[])
+{
+  int i;
+  lin lines = find_identical_ends (filevec);
+
+#if USE_POSIX_THREADS
+  if (1 < threads && PARALLEL_MIN_LINES <= lines)
+    {
+      hash_files_in_parallel (filevec, lines);
+      return;
+    }
+#endif
+
+  /* Each hashed line makes at most one new class.  */
+  equivs_alloc = lines + 1;
+  if (PTRDIFF_MAX / sizeof *eqlines <= equivs_alloc)
     xalloc_die ();
-  equivs = xmalloc (equivs_alloc * sizeof *equivs);
+  eqlines = spare_take (SPARE_EQLINES, equivs_alloc, sizeof *eqlines);
+  equivs_alloc = spare_size (SPARE_EQLINES) / sizeof *eqlines;
   /* Equivalence class 0 is permanently safe for lines that were not
      hashed.  Real equivalence classes start at 1.  */
   equivs_index = 1;
 
-  /* Allocate (one plus) a prime number of hash buckets.  Use a prime
-     number between 1/3 and 2/3 of the value of equiv_allocs,
-     approximately.  */
-  for (i = 9; (size_t) 1 << i < equivs_alloc / 3; i++)
-    continue;
-  nbuckets = ((size_t) 1 << i) - prime_offset[i];
-  if (PTRDIFF_MAX / sizeof *buckets <= nbuckets)
-    xalloc_die ();
-  buckets = zalloc ((nbuckets + 1) * sizeof *buckets);
-  buckets++;
+  /* Allocate a power-of-two number of hash table slots, enough for
+     all the lines without growing the table.  */
+  for (slots_mask = 511; slots_too_full (slots_mask, equivs_alloc); )
+    {
+      if (PTRDIFF_MAX / (2 * sizeof *slots) <= slots_mask + 1)
+        xalloc_die ();
+      slots_mask = 2 * slots_mask + 1;
+    }
+  slots = spare_ztake (SPARE_SLOTS, slots_mask + 1, sizeof *slots);
+  memset (incomplete_slots, 0, sizeof incomplete_slots);
 
   for (i = 0; i < 2; i++)
     find_and_hash_each_line (&filevec[i]);
 
   filevec[0].equiv_max = filevec[1].equiv_max = equivs_index;
 
-  free (equivs);
-  free (buckets - 1);
+  spare_give (SPARE_EQLINES, eqlines, equivs_alloc * sizeof *eqlines);
+  spare_give (SPARE_SLOTS, slots, (slots_mask + 1) * sizeof *slots);
+  free_canon (&canon);
+}
+
+/* A file to read with read_text, and how long that took.  */
+struct reader
+{
+  struct file_data *file;
+  intmax_t nsec;
+};
+
+/* Return the number of nanoseconds elapsed since START.  */
+
+static intmax_t
+nsec_since (struct timespec start)
+{
+  struct timespec now = current_timespec ();
+  return ((intmax_t) (now.tv_sec - start.tv_sec) * TIMESPEC_HZ
+          + now.tv_nsec - start.tv_nsec);
+}
+
+/* Slurp the file of the reader R and prepare its text.  */
+
+static void *
+read_text (void *r)
+{
+  struct reader *rd = r;
+  struct timespec start = current_timespec ();
+  slurp (rd->file);
+  prepare_text (rd->file);
+  rd->nsec = nsec_since (start);
+  return NULL;
+}
+
+/* Given a vector of two file_data objects, read the file associated
+   with each one, and build the table of equivalence classes.
+   Return nonzero if either file appears to be a binary file.
+   If PRETEND_BINARY is nonzero, pretend they are binary regardless.  */
+
+bool
+read_files (struct file_data filevec[], bool pretend_binary)
+{
+  struct reader readers[2] = { { .file = &filevec[0] },
+                               { .file = &filevec[1] } };
+
+  if (sip_files (filevec, pretend_binary))
+    return true;
+
+#if MMAP_INPUT
+  catch_bus_error ();
+  mapped_files = filevec;
+#endif
+
+  if (filevec[0].desc != filevec[1].desc)
+    {
+      struct timespec start = current_timespec ();
+      intmax_t elapsed;
+
+#if USE_POSIX_THREADS
+      /* Read file 1 on a thread of its own while this thread reads
+         file 0, so that waiting for one file's data overlaps waiting
+         for the other's and preparing its text.  */
+      if (1 < threads)
+        run_threads (read_text, readers, sizeof *readers, 2);
+      else
+#endif
+        {
+          read_text (&readers[0]);
+          read_text (&readers[1]);
+        }
+
+      elapsed = nsec_since (start);
+      stats.read_nsec += elapsed;
+      stats.read_overlap_nsec += MAX (0, (readers[0].nsec + readers[1].nsec
+                                          - elapsed));
+    }
+  else
+    {
+      read_text (&readers[0]);
+      stats.read_nsec += readers[0].nsec;
+      filevec[1].buffer = filevec[0].buffer;
+      filevec[1].bufsize = filevec[0].bufsize;
+      filevec[1].buffered = filevec[0].buffered;
+      filevec[1].missing_newline = filevec[0].missing_newline;
+      filevec[1].mapped = filevec[0].mapped;
+    }
+
+  hash_files (filevec);
+  return false;
+}
+
+/* With --max-memory, the files are read and compared a window at a
+   time.  A window holds whole lines.  It ends where the buffer holding
+   it is full or, if possible, earlier, just after an anchor: a line
+   that appears exactly once in the text buffered from each file.  The
+   windows of both files end after the same anchor, so that lines that
+   match are usually in windows that are compared with each other.  */
+
+/* The state of a file being read a window at a time.  */
+struct window
+{
+  /* The number of bytes in the buffer, and the number of them that are
+     in the current window.  The rest were read ahead for later
+     windows.  */
+  size_t total;
+  size_t end;
+
+  /* The number of lines in the current window.  */
+  lin lines;
+
+  /* True if the file's last line is incomplete.  */
+  bool missing_newline;
+
+  /* The bytes just past the current window, which prepare_text may
+     overwrite.  */
+  char saved[2 * sizeof (word)];
+};
+
+static struct window windows[2];
+
+/* True until the first window has been read.  */
+static bool first_window;
+
+/* Let the next windows that read_window reads from the files of
+   FILEVEC hold up to about SIZE bytes.  */
+
+void
+grow_windows (struct file_data filevec[], size_t size)
+{
+  int f;
+
+  if (PTRDIFF_MAX - 3 * sizeof (word) < size)
+    xalloc_die ();
+  size += 2 * sizeof (word) - size % sizeof (word);
+
+  for (f = 0; f < 2; f++)
+    if (filevec[f].bufsize < size)
+      {
+        filevec[f].bufsize = size;
+        filevec[f].buffer = xrealloc (filevec[f].buffer, size);
+      }
+}
+
+/* Like read_files, but do not read the files of FILEVEC yet; instead,
+   prepare to read them a window of at most about SIZE bytes at a time
+   with read_window.  */
+
+bool
+start_windows (struct file_data filevec[], bool pretend_binary, size_t size)
+{
+  int f;
+
+  if (sip_files (filevec, pretend_binary))
+    return true;
 
+  grow_windows (filevec, size);
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *current = &filevec[f];
+      if (current->desc < 0)
+        current->eof = true;
+      current->window_lines = 0;
+      windows[f].total = current->buffered;
+      windows[f].end = 0;
+      memcpy (windows[f].saved, FILE_BUFFER (current),
+              MIN (sizeof windows[f].saved, current->buffered));
+      windows[f].lines = 0;
+      windows[f].missing_newline = false;
+    }
+  first_window = true;
   return false;
 }
+
+/* Return the number of bytes in the buffer of CURRENT that are in
+   complete lines.  */
+
+static size_t
+complete_lines (struct file_data const *current)
+{
+  char const *buf = FILE_BUFFER (current);
+  size_t n = current->buffered;
+  while (n != 0 && buf[n - 1] != '\n')
+    n--;
+  return n;
+}
+
+/* A slot in the hash table used to find anchors.  */
+struct anchor_slot
+{
+  hash_value hash;
+
+  /* For each file, the end of the last line with this hash, and the
+     number of such lines, up to 2.  */
+  size_t end[2];
+  unsigned char count[2];
+};
+
+/* Find an anchor in the first LIM[F] bytes of the buffer of each file
+   FILEVEC[F], which hold only complete lines, and set CUT[F] to the
+   end of the anchor.  Of all the anchors, choose the one that leaves
+   the least text for later windows.  Return false if there is no
+   anchor.  */
+
+static bool
+find_anchor (struct file_data filevec[], size_t const lim[2], size_t cut[2])
+{
+  struct anchor_slot *table;
+  size_t lines = 0;
+  size_t mask, j;
+  size_t best = 0;
+  int f;
+
+  for (f = 0; f < 2; f++)
+    lines += count_newlines (FILE_BUFFER (&filevec[f]), lim[f]);
+  for (mask = 15; mask / 2 < lines; mask = 2 * mask + 1)
+    continue;
+  table = xcalloc (mask + 1, sizeof *table);
+
+  for (f = 0; f < 2; f++)
+    {
+      char const *buf = FILE_BUFFER (&filevec[f]);
+      char const *p = buf;
+      while (p < buf + lim[f])
+        {
+          hash_value h;
+          p = hash_line (p, &h);
+          for (j = h & mask;
+               (table[j].count[0] | table[j].count[1]) && table[j].hash != h;
+               j = (j + 1) & mask)
+            continue;
+          table[j].hash = h;
+          table[j].end[f] = p - buf;
+          table[j].count[f] += table[j].count[f] < 2;
+        }
+    }
+
+  for (j = 0; j <= mask; j++)
+    if (table[j].count[0] == 1 && table[j].count[1] == 1
+        && best < table[j].end[0] + table[j].end[1])
+      {
+        best = table[j].end[0] + table[j].end[1];
+        cut[0] = table[j].end[0];
+        cut[1] = table[j].end[1];
+      }
+
+  free (table);
+  return best != 0;
+}
+
+/* Read the next window of each file of FILEVEC, and build the table of
+   equivalence classes for the windows, as read_files does for whole
+   files.  Return false if there is no more input.  */
+
+bool
+read_window (struct file_data filevec[])
+{
+  size_t lim[2], cut[2];
+  int f;
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *current = &filevec[f];
+      struct window *w = &windows[f];
+      char *buf = FILE_BUFFER (current);
+
+      /* Discard the previous window, restoring the bytes after it.  */
+      memcpy (buf + w->end, w->saved,
+              MIN (sizeof w->saved, w->total - w->end));
+      memmove (buf, buf + w->end, w->total - w->end);
+      current->buffered = w->total - w->end;
+      current->window_lines += w->lines;
+
+      /* Fill the buffer, growing it if it does not hold a whole line.  */
+      for (;;)
+        {
+          file_block_read (current, (current->bufsize - 2 * sizeof (word)
+                                     - current->buffered));
+          lim[f] = current->eof ? current->buffered : complete_lines (current);
+          if (lim[f] != 0 || current->eof)
+            break;
+          if (PTRDIFF_MAX / 2 - sizeof (word) < current->bufsize)
+            xalloc_die ();
+          current->bufsize *= 2;
+          current->buffer = xrealloc (current->buffer, current->bufsize);
+        }
+      w->total = current->buffered;
+    }
+
+  if (! first_window
+      && filevec[0].eof && filevec[1].eof
+      && windows[0].total == 0 && windows[1].total == 0)
+    {
+      for (f = 0; f < 2; f++)
+        filevec[f].missing_newline = windows[f].missing_newline;
+      return false;
+    }
+  first_window = false;
+
+  /* Unless both files fit, end the windows after an anchor, if there
+     is one.  An incomplete last line cannot be an anchor.  */
+  for (f = 0; f < 2; f++)
+    cut[f] = lim[f];
+  if (! (filevec[0].eof && filevec[1].eof))
+    {
+      size_t complete[2];
+      for (f = 0; f < 2; f++)
+        complete[f] = complete_lines (&filevec[f]);
+      find_anchor (filevec, complete, cut);
+    }
+
+  for (f = 0; f < 2; f++)
+    {
+      struct file_data *current = &filevec[f];
+      struct window *w = &windows[f];
+      char const *buf = FILE_BUFFER (current);
+      w->end = cut[f];
+      w->lines = count_newlines (buf, cut[f]);
+      memcpy (w->saved, buf + cut[f],
+              MIN (sizeof w->saved, w->total - cut[f]));
+      current->buffered = cut[f];
+      current->missing_newline = false;
+      prepare_text (current);
+      w->missing_newline |= current->missing_newline;
+    }
+
+  hash_files (filevec);
+  return true;
+}
+
+/* Release the buffer of CURRENT.  */
+
+static void
+release_buffer (struct file_data *current)
+{
+#if MMAP_INPUT
+  if (current->mapped)
+    {
+      current->mapped = false;
+      munmap (current->buffer, current->bufsize);
+      return;
+    }
+#endif
+  free (current->buffer);
+}
+
+/* Release the buffers of the two files in FILEVEC, which may share one.  */
+
+void
+release_buffers (struct file_data filevec[])
+{
+#if MMAP_INPUT
+  mapped_files = NULL;
+#endif
+  if (filevec[0].buffer != filevec[1].buffer)
+    release_buffer (&filevec[0]);
+  release_buffer (&filevec[1]);
+}
@@ -0,0 +1,1226 @@
+/* Vectorized scanning of input lines for GNU DIFF.
+
+   Copyright (C) 2021 Free Software Foundation, Inc.
+
+   This file is part of GNU DIFF.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "diff.h"
+
+/* Use SSE2 kernels, and AVX2 and AVX-512 kernels where the CPU
+   supports them, when the compiler can generate all three.  */
+#if defined __x86_64__ && (4 < __GNUC__ + (9 <= __GNUC_MINOR__) \
+                           || defined __clang__)
+# define SCAN_X86 1
+/* Keep -Wsystem-headers from reporting the casts and shifts within
+   the intrinsics themselves.  */
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+# pragma GCC diagnostic ignored "-Wshift-overflow"
+# include <immintrin.h>
+# pragma GCC diagnostic pop
+#else
+# define SCAN_X86 0
+#endif
+
+/* Multipliers for mixing words into a hash value, from wyhash.  */
+#define HASH_MULTIPLIER0 0xa0761d6478bd642fu
+#define HASH_MULTIPLIER1 0xe7037ed1a0b428dbu
+
+/* Return the word at P, which need not be aligned.  */
+static inline word
+load_word (char const *p)
+{
+  word w;
+  memcpy (&w, p, sizeof w);
+  return w;
+}
+
+/* Return W with all but its first N bytes (in memory order) cleared,
+   where 0 < N < sizeof W.  */
+static inline word
+first_bytes (word w, size_t n)
+{
+#ifdef WORDS_BIGENDIAN
+  return w & ~(~(word) 0 >> (n * CHAR_BIT));
+#else
+  return w & ~(~(word) 0 << (n * CHAR_BIT));
+#endif
+}
+
+/* A word with each of its bytes equal to 1.  */
+#define WORD_ONES ((word) -1 / UCHAR_MAX)
+
+/* The white space kernels can handle a word at a time when they can
+   find the first flagged byte in a word quickly.  */
+#ifdef __GNUC__
+# define SCAN_WORDS 1
+#else
+# define SCAN_WORDS 0
+#endif
+
+#if SCAN_WORDS
+/* Return the bytes of W that are white space in the C locale, each
+   with its high bit set and its other bits clear.  */
+static inline word
+space_bytes (word w)
+{
+  word high = WORD_ONES * 0x80;
+  word heptets = w & ~high;
+  word ge_tab = heptets + WORD_ONES * (0x80 - '\t');
+  word gt_cr = heptets + WORD_ONES * (0x80 - '\r' - 1);
+  word not_space = (heptets ^ WORD_ONES * ' ') + WORD_ONES * 0x7f;
+  return ((ge_tab & ~gt_cr) | ~not_space) & ~w & high;
+}
+
+/* Return the bytes of W that are newlines, each with its high bit set
+   and its other bits clear.  */
+static inline word
+newline_bytes (word w)
+{
+  word high = WORD_ONES * 0x80;
+  word x = w ^ WORD_ONES * '\n';
+  return ~(((x & ~high) + ~high) | x | ~high);
+}
+
+/* Return the index in memory order of the first byte of W with its
+   high bit set, where W is nonzero.  */
+static inline size_t
+first_flagged_byte (word w)
+{
+  unsigned long long int m = w;
+# ifdef WORDS_BIGENDIAN
+  return ((__builtin_clzll (m) - (sizeof m - sizeof w) * CHAR_BIT)
+          / CHAR_BIT);
+# else
+  return __builtin_ctzll (m) / CHAR_BIT;
+# endif
+}
+#endif
+
+/* Return W with the ASCII upper case letters in its bytes converted
+   to lower case, handling all bytes at once.  */
+static inline word
+ascii_tolower_word (word w)
+{
+  word high = WORD_ONES * 0x80;
+  word heptets = w & ~high;
+  word ge_a = heptets + WORD_ONES * (0x80 - 'A');
+  word gt_z = heptets + WORD_ONES * (0x7f - 'Z');
+  word upper = ge_a & ~gt_z & ~w & high;
+  return w | upper >> 2;
+}
+
+#if defined __SIZEOF_INT128__ && SIZE_MAX == UINT64_MAX
+
+/* Multiply A by B and fold the high half of the 128-bit product into
+   the low half, so that every input bit affects every output bit.  */
+static inline hash_value
+fold_multiply (hash_value a, hash_value b)
+{
+  unsigned __int128 m = (unsigned __int128) a * b;
+  return m ^ m >> 64;
+}
+
+/* Given a hash value and a new word, return a new hash value.  */
+static inline hash_value
+mix_word (hash_value h, word w)
+{
+  return fold_multiply (h ^ w ^ HASH_MULTIPLIER0, HASH_MULTIPLIER1);
+}
+
+/* Return the final hash of a line of N bytes whose words hashed to H.  */
+static inline hash_value
+mix_length (hash_value h, size_t n)
+{
+  return fold_multiply (h ^ n, HASH_MULTIPLIER0);
+}
+
+#else
+
+/* Rotate an unsigned value to the left.  */
+# define ROL(v, n) ((v) << (n) | (v) >> (sizeof (v) * CHAR_BIT - (n)))
+
+static inline hash_value
+mix_word (hash_value h, word w)
+{
+  return (ROL (h, 5) ^ w) * (hash_value) HASH_MULTIPLIER1;
+}
+
+static inline hash_value
+mix_length (hash_value h, size_t n)
+{
+  h = mix_word (h, n);
+  return h ^ h >> (sizeof h * CHAR_BIT / 2);
+}
+
+#endif
+
+/* Continue the hash H of the line ending at Q, of which the bytes
+   before W have been hashed, and which is N bytes long.  Every line
+   is followed by at least sizeof (word) readable bytes, so the last
+   partial word can be loaded whole and masked.  */
+static inline hash_value
+hash_finish (hash_value h, char const *w, char const *q, size_t n)
+{
+  for (; w + sizeof (word) <= q; w += sizeof (word))
+    h = mix_word (h, load_word (w));
+  if (w < q)
+    h = mix_word (h, first_bytes (load_word (w), q - w));
+  return mix_length (h, n);
+}
+
+/* A hash being computed a byte at a time, for the options that
+   transform the line before hashing it.  */
+struct hasher
+{
+  hash_value h;		/* Hash of the words completed so far.  */
+  word w;		/* The word being filled.  */
+  size_t n;		/* Number of bytes hashed.  */
+};
+
+/* Add the byte C to the hash HS.  */
+static inline void
+hash_byte (struct hasher *hs, unsigned char c)
+{
+  hs->w = hs->w << CHAR_BIT | c;
+  if (++hs->n % sizeof (word) == 0)
+    {
+      hs->h = mix_word (hs->h, hs->w);
+      hs->w = 0;
+    }
+}
+
+/* Return the final value of the hash HS.  */
+static inline hash_value
+hash_value_of (struct hasher const *hs)
+{
+  hash_value h = hs->h;
+  if (hs->n % sizeof (word))
+    h = mix_word (h, hs->w);
+  return mix_length (h, hs->n);
+}
+
+/* Hash the line at P, which ends in a newline, into *HP, and return
+   the address just past the newline.  This is the portable kernel;
+   the vectorized ones below compute the same hash.  */
+static char const *
+hash_line_portable (char const *p, hash_value *hp)
+{
+  char const *q = rawmemchr (p, '\n');
+  *hp = hash_finish (0, p, q, q - p);
+  return q + 1;
+}
+
+#if SCAN_X86
+
+/* The vectorized kernels find the newline with aligned loads, which
+   cannot cross a page boundary and so cannot fault even when they
+   read a little outside the buffer.  While no newline has been seen,
+   they hash each word that lies entirely in the blocks scanned so far.  */
+
+static char const *
+hash_line_sse2 (char const *p, hash_value *hp)
+{
+  __m128i const nl = _mm_set1_epi8 ('\n');
+  char const *blk = (char const *) ((uintptr_t) p & -16);
+  char const *w = p;
+  hash_value h = 0;
+  unsigned int mask =
+    _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_load_si128 ((void const *) blk),
+                                       nl));
+  mask &= -1u << (p - blk);
+  while (! mask)
+    {
+      blk += 16;
+      for (; w + sizeof (word) <= blk; w += sizeof (word))
+        h = mix_word (h, load_word (w));
+      mask = _mm_movemask_epi8 (_mm_cmpeq_epi8
+                                (_mm_load_si128 ((void const *) blk), nl));
+    }
+  char const *q = blk + __builtin_ctz (mask);
+  *hp = hash_finish (h, w, q, q - p);
+  return q + 1;
+}
+
+static char const * __attribute__ ((target ("avx2")))
+hash_line_avx2 (char const *p, hash_value *hp)
+{
+  __m256i const nl = _mm256_set1_epi8 ('\n');
+  char const *blk = (char const *) ((uintptr_t) p & -32);
+  char const *w = p;
+  hash_value h = 0;
+  unsigned int mask =
+    _mm256_movemask_epi8 (_mm256_cmpeq_epi8
+                          (_mm256_load_si256 ((void const *) blk), nl));
+  mask &= -1u << (p - blk);
+  while (! mask)
+    {
+      blk += 32;
+      for (; w + sizeof (word) <= blk; w += sizeof (word))
+        h = mix_word (h, load_word (w));
+      mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8
+                                   (_mm256_load_si256 ((void const *) blk),
+                                    nl));
+    }
+  char const *q = blk + __builtin_ctz (mask);
+  *hp = hash_finish (h, w, q, q - p);
+  return q + 1;
+}
+
+static char const * __attribute__ ((target ("avx512f,avx512bw")))
+hash_line_avx512 (char const *p, hash_value *hp)
+{
+  __m512i const nl = _mm512_set1_epi8 ('\n');
+  char const *blk = (char const *) ((uintptr_t) p & -64);
+  char const *w = p;
+  hash_value h = 0;
+  unsigned long long mask =
+    _mm512_cmpeq_epi8_mask (_mm512_load_si512 (blk), nl);
+  mask &= -1ull << (p - blk);
+  while (! mask)
+    {
+      blk += 64;
+      for (; w + sizeof (word) <= blk; w += sizeof (word))
+        h = mix_word (h, load_word (w));
+      mask = _mm512_cmpeq_epi8_mask (_mm512_load_si512 (blk), nl);
+    }
+  char const *q = blk + __builtin_ctzll (mask);
+  *hp = hash_finish (h, w, q, q - p);
+  return q + 1;
+}
+
+#endif
+
+/* Hash the line at P, ignoring case, when tolower affects only the
+   ASCII letters, so that whole words can be converted at once.  */
+static char const *
+hash_line_ascii_case (char const *p, hash_value *hp)
+{
+  char const *q = rawmemchr (p, '\n');
+  char const *w = p;
+  hash_value h = 0;
+  for (; w + sizeof (word) <= q; w += sizeof (word))
+    h = mix_word (h, ascii_tolower_word (load_word (w)));
+  if (w < q)
+    h = mix_word (h, ascii_tolower_word (first_bytes (load_word (w), q - w)));
+  *hp = mix_length (h, q - p);
+  return q + 1;
+}
+
+/* tolower applied to every byte value, for hashing with -i.  */
+static unsigned char fold_table[UCHAR_MAX + 1];
+
+/* Hash the line at P, ignoring case, one byte at a time.  */
+static char const *
+hash_line_case (char const *p, hash_value *hp)
+{
+  struct hasher hs = { 0 };
+  unsigned char c;
+  while ((c = *p++) != '\n')
+    hash_byte (&hs, fold_table[c]);
+  *hp = hash_value_of (&hs);
+  return p;
+}
+
+/* Whether each byte value is white space, for hashing with the white
+   space options.  */
+static bool space_table[UCHAR_MAX + 1];
+
+/* The bytes of a line as transformed by the options, collected so
+   that they can be hashed a word at a time like untransformed lines.
+   Storing every byte and advancing only past the ones to keep avoids
+   branching on each byte.  */
+enum { PACKED_SIZE = 32 * sizeof (word) };
+struct packed_line
+{
+  hash_value h;		/* Hash of the words hashed so far.  */
+  size_t n;		/* Number of bytes hashed.  */
+  size_t len;		/* Number of bytes in BUF not yet hashed.  */
+  char buf[PACKED_SIZE + 2 * sizeof (word)];
+};
+
+/* If the buffer of PL is full, hash its whole words, except that the
+   last byte is kept so that it can still be taken back.  */
+static inline void
+pack_flush (struct packed_line *pl)
+{
+  if (PACKED_SIZE <= pl->len)
+    {
+      size_t words = (pl->len - 1) - (pl->len - 1) % sizeof (word);
+      for (size_t i = 0; i < words; i += sizeof (word))
+        pl->h = mix_word (pl->h, load_word (pl->buf + i));
+      memcpy (pl->buf, pl->buf + words, pl->len - words);
+      pl->n += words;
+      pl->len -= words;
+    }
+}
+
+/* Return the final value of the hash of PL.  */
+static inline hash_value
+pack_finish (struct packed_line const *pl)
+{
+  return hash_finish (pl->h, pl->buf, pl->buf + pl->len, pl->n + pl->len);
+}
+
+/* Hash the line at P as transformed by IG_WHITE_SPACE, and by -i if
+   FOLD.  If WORDS, white space is as in the C locale and -i affects
+   only ASCII letters, so that the line can be handled a word at a
+   time.  Any two lines that lines_differ considers equal must have the
+   same hash.  This is a template: the kernels below instantiate it for
+   each combination of options, so that the options are tested once,
+   when a kernel is selected, and not for each line or byte.  */
+static inline char const * _GL_ATTRIBUTE_ALWAYS_INLINE
+hash_line_spaces (char const *p, hash_value *hp,
+                  enum DIFF_white_space ig_white_space, bool fold,
+                  bool words)
+{
+  unsigned char c;
+
+  switch (ig_white_space)
+    {
+    case IGNORE_ALL_SPACE:
+    case IGNORE_SPACE_CHANGE:
+#if SCAN_WORDS
+      if (words && ig_white_space == IGNORE_ALL_SPACE)
+        {
+          /* Copy the text a word at a time, and then, if the word has
+             white space before the newline, squeeze it out.  The bytes
+             copied past the end of the text are overwritten later.  */
+          struct packed_line pl;
+          pl.h = pl.n = pl.len = 0;
+          for (;;)
+            {
+              word w = load_word (p);
+              word newlines = newline_bytes (w);
+              word spaces = space_bytes (w);
+              size_t n = newlines ? first_flagged_byte (newlines) : sizeof w;
+              size_t i = spaces ? first_flagged_byte (spaces) : sizeof w;
+              if (fold)
+                w = ascii_tolower_word (w);
+              memcpy (pl.buf + pl.len, &w, sizeof w);
+              if (n <= i)
+                pl.len += n;
+              else
+                {
+                  pl.len += i;
+                  for (; i < n; i++)
+                    {
+                      c = p[i];
+                      pl.buf[pl.len] = fold ? fold_table[c] : c;
+                      pl.len += ! space_table[c];
+                    }
+                }
+              if (newlines)
+                {
+                  p += n + 1;
+                  break;
+                }
+              p += sizeof w;
+              pack_flush (&pl);
+            }
+          *hp = pack_finish (&pl);
+          return p;
+        }
+      if (words)
+        {
+          /* Copy the text up to the next white space a word at a time.
+             The bytes copied past it are overwritten later.  */
+          struct packed_line pl;
+          pl.h = pl.n = pl.len = 0;
+          for (;;)
+            {
+              word w = load_word (p);
+              word spaces = space_bytes (w);
+              size_t n = spaces ? first_flagged_byte (spaces) : sizeof w;
+              if (fold)
+                w = ascii_tolower_word (w);
+              memcpy (pl.buf + pl.len, &w, sizeof w);
+              pl.len += n;
+              p += n;
+              if (spaces)
+                {
+                  if (*p++ == '\n')
+                    break;
+                  if (ig_white_space == IGNORE_SPACE_CHANGE)
+                    {
+                      while (space_table[c = *p] && c != '\n')
+                        p++;
+                      if (c == '\n')
+                        {
+                          p++;
+                          break;
+                        }
+                      pl.buf[pl.len++] = ' ';
+                    }
+                }
+              pack_flush (&pl);
+            }
+          *hp = pack_finish (&pl);
+          return p;
+        }
+#endif
+      {
+        /* With -b, a run of white space becomes a single space, unless
+           it ends the line.  Make the space pending at each white
+           space byte, and store it before the next other byte.  */
+        struct packed_line pl;
+        bool pending = false;
+        pl.h = pl.n = pl.len = 0;
+        while ((c = *p++) != '\n')
+          {
+            bool space = space_table[c];
+            if (ig_white_space == IGNORE_SPACE_CHANGE)
+              {
+                pl.buf[pl.len] = ' ';
+                pl.len += pending & !space;
+                pending = space;
+              }
+            pl.buf[pl.len] = fold ? fold_table[c] : c;
+            pl.len += !space;
+            pack_flush (&pl);
+          }
+        *hp = pack_finish (&pl);
+        return p;
+      }
+
+    case IGNORE_TRAILING_SPACE:
+      {
+        char const *q = rawmemchr (p, '\n');
+        char const *end = q;
+        while (p < end && space_table[(unsigned char) end[-1]])
+          end--;
+        if (! fold)
+          *hp = hash_finish (0, p, end, end - p);
+        else if (words)
+          {
+            char const *w = p;
+            hash_value h = 0;
+            for (; w + sizeof (word) <= end; w += sizeof (word))
+              h = mix_word (h, ascii_tolower_word (load_word (w)));
+            if (w < end)
+              h = mix_word (h, ascii_tolower_word (first_bytes (load_word (w),
+                                                                end - w)));
+            *hp = mix_length (h, end - p);
+          }
+        else
+          {
+            struct packed_line pl;
+            pl.h = pl.n = pl.len = 0;
+            for (; p < end; p++)
+              {
+                pl.buf[pl.len++] = fold_table[(unsigned char) *p];
+                pack_flush (&pl);
+              }
+            *hp = pack_finish (&pl);
+          }
+        return q + 1;
+      }
+
+    case IGNORE_TAB_EXPANSION:
+    case IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE:
+      {
+        struct hasher hs = { 0 };
+        size_t column = 0;
+        while ((c = *p++) != '\n')
+          {
+            if (ig_white_space & IGNORE_TRAILING_SPACE
+                && space_table[c])
+              {
+                char const *p1 = p;
+                unsigned char c1;
+                do
+                  if ((c1 = *p1++) == '\n')
+                    {
+                      p = p1;
+                      goto hashing_done;
+                    }
+                while (space_table[c1]);
+              }
+
+            size_t repetitions = 1;
+
+            switch (c)
+              {
+              case '\b':
+                column -= 0 < column;
+                break;
+
+              case '\t':
+                c = ' ';
+                repetitions = tabsize - column % tabsize;
+                column = (column + repetitions < column
+                          ? 0
+                          : column + repetitions);
+                break;
+
+              case '\r':
+                column = 0;
+                break;
+
+              default:
+                column++;
+                break;
+              }
+
+            if (fold)
+              c = fold_table[c];
+
+            do
+              hash_byte (&hs, c);
+            while (--repetitions != 0);
+          }
+      hashing_done:
+        *hp = hash_value_of (&hs);
+        return p;
+      }
+
+    default:
+      abort ();
+    }
+}
+
+/* Define NAME as a kernel hashing lines with the white space option
+   IG_WHITE_SPACE, and ignoring case if FOLD.  */
+#define DEFINE_HASH_LINE_SPACES(name, ig_white_space, fold, words)	\
+  static char const *							\
+  name (char const *p, hash_value *hp)					\
+  {									\
+    return hash_line_spaces (p, hp, ig_white_space, fold, words);	\
+  }
+
+DEFINE_HASH_LINE_SPACES (hash_line_E, IGNORE_TAB_EXPANSION, false, false)
+DEFINE_HASH_LINE_SPACES (hash_line_E_i, IGNORE_TAB_EXPANSION, true, false)
+DEFINE_HASH_LINE_SPACES (hash_line_Z, IGNORE_TRAILING_SPACE, false, false)
+DEFINE_HASH_LINE_SPACES (hash_line_Z_i, IGNORE_TRAILING_SPACE, true, false)
+DEFINE_HASH_LINE_SPACES (hash_line_Z_ascii_i, IGNORE_TRAILING_SPACE,
+                         true, true)
+DEFINE_HASH_LINE_SPACES (hash_line_EZ,
+                         IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE,
+                         false, false)
+DEFINE_HASH_LINE_SPACES (hash_line_EZ_i,
+                         IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE,
+                         true, false)
+DEFINE_HASH_LINE_SPACES (hash_line_b, IGNORE_SPACE_CHANGE, false, false)
+DEFINE_HASH_LINE_SPACES (hash_line_b_i, IGNORE_SPACE_CHANGE, true, false)
+DEFINE_HASH_LINE_SPACES (hash_line_w, IGNORE_ALL_SPACE, false, false)
+DEFINE_HASH_LINE_SPACES (hash_line_w_i, IGNORE_ALL_SPACE, true, false)
+#if SCAN_WORDS
+DEFINE_HASH_LINE_SPACES (hash_line_b_words, IGNORE_SPACE_CHANGE,
+                         false, true)
+DEFINE_HASH_LINE_SPACES (hash_line_b_ascii_i_words, IGNORE_SPACE_CHANGE,
+                         true, true)
+DEFINE_HASH_LINE_SPACES (hash_line_w_words, IGNORE_ALL_SPACE, false, true)
+DEFINE_HASH_LINE_SPACES (hash_line_w_ascii_i_words, IGNORE_ALL_SPACE,
+                         true, true)
+#endif
+
+#if SCAN_X86
+
+/* For each set of bits in a byte, the pshufb control that moves the
+   corresponding bytes of 8 to the start, in order.  */
+static uint64_t pack_shuffle[UCHAR_MAX + 1];
+
+/* Hash the line at P as transformed by IG_WHITE_SPACE, which is -b or
+   -w, and by -i if FOLD, when white space is as in the C locale and -i
+   affects only ASCII letters.  Each aligned block of 16 bytes is
+   classified at once, and the bytes to keep are packed together with
+   pshufb.  This is a template like hash_line_spaces.  */
+static inline char const * _GL_ATTRIBUTE_ALWAYS_INLINE
+  __attribute__ ((target ("ssse3,popcnt")))
+hash_line_spaces_ssse3 (char const *p, hash_value *hp,
+                        enum DIFF_white_space ig_white_space, bool fold)
+{
+  __m128i const nl = _mm_set1_epi8 ('\n');
+  __m128i const sp = _mm_set1_epi8 (' ');
+  __m128i const tab = _mm_set1_epi8 ('\t');
+  __m128i const ctl = _mm_set1_epi8 ('\r' - '\t');
+  __m128i const upper = _mm_set1_epi8 ('A');
+  __m128i const letters = _mm_set1_epi8 ('Z' - 'A');
+  __m128i const case_bit = _mm_set1_epi8 ('a' - 'A');
+  __m128i const high = _mm_set1_epi8 (8);
+  char const *blk = (char const *) ((uintptr_t) p & -16);
+  unsigned int valid = 0xffff & (-1u << (p - blk));
+  unsigned int after_space = 0;
+  struct packed_line pl;
+  pl.h = pl.n = pl.len = 0;
+
+  for (;; blk += 16, valid = 0xffff)
+    {
+      __m128i v = _mm_load_si128 ((void const *) blk);
+      __m128i d = _mm_sub_epi8 (v, tab);
+      __m128i s = _mm_or_si128 (_mm_cmpeq_epi8 (v, sp),
+                                _mm_cmpeq_epi8 (_mm_min_epu8 (d, ctl), d));
+      unsigned int newlines =
+        valid & _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, nl));
+      if (newlines)
+        valid &= (newlines & -newlines) - 1;
+      unsigned int spaces = valid & _mm_movemask_epi8 (s);
+      unsigned int keep = valid & ~spaces;
+      if (ig_white_space == IGNORE_SPACE_CHANGE)
+        {
+          /* Keep the first byte of each run of white space, as a space.  */
+          keep |= spaces & ~(spaces << 1 | after_space);
+          after_space = spaces >> 15;
+          v = _mm_or_si128 (_mm_andnot_si128 (s, v), _mm_and_si128 (s, sp));
+        }
+      if (fold)
+        {
+          __m128i u = _mm_sub_epi8 (v, upper);
+          v = _mm_add_epi8 (v, _mm_and_si128 (_mm_cmpeq_epi8
+                                              (_mm_min_epu8 (u, letters), u),
+                                              case_bit));
+        }
+      __m128i lo = _mm_cvtsi64_si128 (pack_shuffle[keep & 0xff]);
+      __m128i hi = _mm_add_epi8 (_mm_cvtsi64_si128 (pack_shuffle[keep >> 8]),
+                                 high);
+      _mm_storel_epi64 ((void *) (pl.buf + pl.len),
+                        _mm_shuffle_epi8 (v, lo));
+      pl.len += __builtin_popcount (keep & 0xff);
+      _mm_storel_epi64 ((void *) (pl.buf + pl.len),
+                        _mm_shuffle_epi8 (v, hi));
+      pl.len += __builtin_popcount (keep >> 8);
+      if (newlines)
+        {
+          /* A space packed last stands for white space ending the line.  */
+          if (ig_white_space == IGNORE_SPACE_CHANGE
+              && pl.len && pl.buf[pl.len - 1] == ' ')
+            pl.len--;
+          *hp = pack_finish (&pl);
+          return blk + __builtin_ctz (newlines) + 1;
+        }
+      pack_flush (&pl);
+    }
+}
+
+# define DEFINE_HASH_LINE_SPACES_SSSE3(name, ig_white_space, fold)	\
+  static char const * __attribute__ ((target ("ssse3,popcnt")))	\
+  name (char const *p, hash_value *hp)					\
+  {									\
+    return hash_line_spaces_ssse3 (p, hp, ig_white_space, fold);	\
+  }
+
+DEFINE_HASH_LINE_SPACES_SSSE3 (hash_line_b_ssse3, IGNORE_SPACE_CHANGE, false)
+DEFINE_HASH_LINE_SPACES_SSSE3 (hash_line_b_ascii_i_ssse3,
+                               IGNORE_SPACE_CHANGE, true)
+DEFINE_HASH_LINE_SPACES_SSSE3 (hash_line_w_ssse3, IGNORE_ALL_SPACE, false)
+DEFINE_HASH_LINE_SPACES_SSSE3 (hash_line_w_ascii_i_ssse3,
+                               IGNORE_ALL_SPACE, true)
+
+#endif
+
+/* The white space kernels, indexed by white space option, by whether
+   case is ignored, and by whether -i affects only ASCII letters and
+   white space is as in the C locale.  */
+static char const *(*const hash_line_spaces_kernels[][2][2])
+  (char const *, hash_value *) =
+  {
+    [IGNORE_TAB_EXPANSION]
+      = { { hash_line_E, hash_line_E }, { hash_line_E_i, hash_line_E_i } },
+    [IGNORE_TRAILING_SPACE]
+      = { { hash_line_Z, hash_line_Z },
+          { hash_line_Z_i, hash_line_Z_ascii_i } },
+    [IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE]
+      = { { hash_line_EZ, hash_line_EZ },
+          { hash_line_EZ_i, hash_line_EZ_i } },
+#if SCAN_WORDS
+    [IGNORE_SPACE_CHANGE]
+      = { { hash_line_b, hash_line_b_words },
+          { hash_line_b_i, hash_line_b_ascii_i_words } },
+    [IGNORE_ALL_SPACE]
+      = { { hash_line_w, hash_line_w_words },
+          { hash_line_w_i, hash_line_w_ascii_i_words } },
+#else
+    [IGNORE_SPACE_CHANGE]
+      = { { hash_line_b, hash_line_b }, { hash_line_b_i, hash_line_b_i } },
+    [IGNORE_ALL_SPACE]
+      = { { hash_line_w, hash_line_w }, { hash_line_w_i, hash_line_w_i } },
+#endif
+  };
+
+/* Store at OUT the canonical form of the LENGTH bytes of the line at
+   P under IG_WHITE_SPACE, and under -i if FOLD, and return its length,
+   which is at most LENGTH.  Two lines have the same canonical form if
+   and only if lines_differ considers them equal.  This is a template
+   like hash_line_spaces.  */
+static inline size_t _GL_ATTRIBUTE_ALWAYS_INLINE
+canon_line_template (char const *p, size_t length, char *out,
+                     enum DIFF_white_space ig_white_space, bool fold)
+{
+  char const *end = p + length;
+  size_t n = 0;
+  bool pending = false;
+
+  if (ig_white_space == IGNORE_TRAILING_SPACE)
+    while (p < end && space_table[(unsigned char) end[-1]])
+      end--;
+
+  for (; p < end; p++)
+    {
+      unsigned char c = *p;
+      bool space = space_table[c];
+      if (ig_white_space == IGNORE_SPACE_CHANGE)
+        {
+          out[n] = ' ';
+          n += pending & !space;
+          pending = space;
+        }
+      out[n] = fold ? fold_table[c] : c;
+      n += ! (space && (ig_white_space == IGNORE_SPACE_CHANGE
+                        || ig_white_space == IGNORE_ALL_SPACE));
+    }
+  return n;
+}
+
+/* Define NAME as a canon_line for the white space option
+   IG_WHITE_SPACE, ignoring case if FOLD.  */
+#define DEFINE_CANON_LINE(name, ig_white_space, fold)			\
+  static size_t								\
+  name (char const *p, size_t length, char *out)			\
+  {									\
+    return canon_line_template (p, length, out, ig_white_space, fold);	\
+  }
+
+DEFINE_CANON_LINE (canon_line_i, IGNORE_NO_WHITE_SPACE, true)
+DEFINE_CANON_LINE (canon_line_Z, IGNORE_TRAILING_SPACE, false)
+DEFINE_CANON_LINE (canon_line_Z_i, IGNORE_TRAILING_SPACE, true)
+DEFINE_CANON_LINE (canon_line_b, IGNORE_SPACE_CHANGE, false)
+DEFINE_CANON_LINE (canon_line_b_i, IGNORE_SPACE_CHANGE, true)
+DEFINE_CANON_LINE (canon_line_w, IGNORE_ALL_SPACE, false)
+DEFINE_CANON_LINE (canon_line_w_i, IGNORE_ALL_SPACE, true)
+
+/* The instances of canon_line, indexed by white space option and by
+   whether case is ignored.  With tab expansion a canonical form could
+   be longer than the line by a factor of the tab size, so lines are
+   compared with lines_differ instead.  */
+static size_t (*const canon_line_kernels[][2]) (char const *, size_t,
+                                                  char *) =
+  {
+    [IGNORE_NO_WHITE_SPACE] = { NULL, canon_line_i },
+    [IGNORE_TRAILING_SPACE] = { canon_line_Z, canon_line_Z_i },
+    [IGNORE_SPACE_CHANGE] = { canon_line_b, canon_line_b_i },
+    [IGNORE_ALL_SPACE] = { canon_line_w, canon_line_w_i },
+  };
+
+/* Return the number of bytes at the start of the N bytes at A and
+   those at B that are equal.  */
+static size_t
+common_prefix_portable (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + sizeof (word) <= n; i += sizeof (word))
+    if (load_word (a + i) != load_word (b + i))
+      break;
+  while (i < n && a[i] == b[i])
+    i++;
+  return i;
+}
+
+/* Return the number of bytes at the end of the N bytes before A and
+   those before B that are equal.  */
+static size_t
+common_suffix_portable (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + sizeof (word) <= n; i += sizeof (word))
+    if (load_word (a - i - sizeof (word)) != load_word (b - i - sizeof (word)))
+      break;
+  while (i < n && a[-1 - i] == b[-1 - i])
+    i++;
+  return i;
+}
+
+/* Return the number of newlines in the N bytes at P.  */
+static size_t
+count_newlines_portable (char const *p, size_t n)
+{
+  word const low = WORD_ONES * 0x7f;
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + sizeof (word) <= n; i += sizeof (word))
+    {
+      /* Set the top bit of each byte of W that is a newline, and clear
+         all the other bits; then add up the top bits.  */
+      word w = load_word (p + i) ^ (WORD_ONES * '\n');
+      w = ~(((w & low) + low) | w | low);
+      count += (w >> (CHAR_BIT - 1)) * WORD_ONES >> (sizeof w - 1) * CHAR_BIT;
+    }
+  for (; i < n; i++)
+    count += p[i] == '\n';
+  return count;
+}
+
+/* Return the number of bytes at the start of the N bytes at P that
+   are printable ASCII characters, each of which takes one column.  */
+static size_t
+printable_prefix_portable (char const *p, size_t n)
+{
+  word const high = WORD_ONES * 0x80;
+  size_t i = 0;
+  for (; i + sizeof (word) <= n; i += sizeof (word))
+    {
+      /* Stop at a word with a byte that is not ASCII, or whose low
+         seven bits are less than a space or all set.  */
+      word w = load_word (p + i);
+      word heptets = w & ~high;
+      if ((w | ~(heptets + WORD_ONES * (0x80 - ' ')) | (heptets + WORD_ONES))
+          & high)
+        break;
+    }
+  while (i < n && ' ' <= p[i] && p[i] < 0x7f)
+    i++;
+  return i;
+}
+
+/* Remove each carriage return that precedes a newline in the N bytes
+   at P, and return the number of bytes left.  Bytes before the first
+   such carriage return are not written.  */
+static size_t
+strip_cr_portable (char *p, size_t n)
+{
+  char const *lim = p + n;
+  char *src = p;
+  char *q = p;
+  char *dst = p;
+  size_t len;
+
+  while ((q = memchr (q, '\r', lim - q)) && ++q < lim)
+    if (*q == '\n')
+      {
+        len = q - 1 - src;
+        if (dst != src)
+          memmove (dst, src, len);
+        dst += len;
+        src = q;
+      }
+
+  len = lim - src;
+  if (dst != src)
+    memmove (dst, src, len);
+  return dst + len - p;
+}
+
+#if SCAN_X86
+
+/* The vectorized versions of these kernels use unaligned loads that
+   stay within the bytes given, and leave any remainder shorter than a
+   vector to the portable ones.  */
+
+static size_t
+common_prefix_sse2 (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i va = _mm_loadu_si128 ((void const *) (a + i));
+      __m128i vb = _mm_loadu_si128 ((void const *) (b + i));
+      unsigned int ne = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (va, vb)) & 0xffff;
+      if (ne)
+        return i + __builtin_ctz (ne);
+    }
+  return i + common_prefix_portable (a + i, b + i, n - i);
+}
+
+static size_t
+common_suffix_sse2 (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i va = _mm_loadu_si128 ((void const *) (a - i - 16));
+      __m128i vb = _mm_loadu_si128 ((void const *) (b - i - 16));
+      unsigned int ne = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (va, vb)) & 0xffff;
+      if (ne)
+        return i + __builtin_clz (ne) - (sizeof ne * CHAR_BIT - 16);
+    }
+  return i + common_suffix_portable (a - i, b - i, n - i);
+}
+
+static size_t
+count_newlines_sse2 (char const *p, size_t n)
+{
+  __m128i const nl = _mm_set1_epi8 ('\n');
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    count += __builtin_popcount
+      (_mm_movemask_epi8 (_mm_cmpeq_epi8
+                          (_mm_loadu_si128 ((void const *) (p + i)), nl)));
+  return count + count_newlines_portable (p + i, n - i);
+}
+
+static size_t __attribute__ ((target ("avx2")))
+common_prefix_avx2 (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    {
+      __m256i va = _mm256_loadu_si256 ((void const *) (a + i));
+      __m256i vb = _mm256_loadu_si256 ((void const *) (b + i));
+      unsigned int ne = ~_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (va, vb));
+      if (ne)
+        return i + __builtin_ctz (ne);
+    }
+  return i + common_prefix_portable (a + i, b + i, n - i);
+}
+
+static size_t __attribute__ ((target ("avx2")))
+common_suffix_avx2 (char const *a, char const *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    {
+      __m256i va = _mm256_loadu_si256 ((void const *) (a - i - 32));
+      __m256i vb = _mm256_loadu_si256 ((void const *) (b - i - 32));
+      unsigned int ne = ~_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (va, vb));
+      if (ne)
+        return i + __builtin_clz (ne);
+    }
+  return i + common_suffix_portable (a - i, b - i, n - i);
+}
+
+static size_t __attribute__ ((target ("avx2,popcnt")))
+count_newlines_avx2 (char const *p, size_t n)
+{
+  __m256i const nl = _mm256_set1_epi8 ('\n');
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    count += __builtin_popcount
+      (_mm256_movemask_epi8 (_mm256_cmpeq_epi8
+                             (_mm256_loadu_si256 ((void const *) (p + i)),
+                              nl)));
+  return count + count_newlines_portable (p + i, n - i);
+}
+
+/* Bytes of 0x80 and up are negative as signed bytes, so these kernels
+   find the printable ones with a signed comparison.  */
+
+static size_t
+printable_prefix_sse2 (char const *p, size_t n)
+{
+  __m128i const below = _mm_set1_epi8 (' ' - 1);
+  __m128i const del = _mm_set1_epi8 (0x7f);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((void const *) (p + i));
+      unsigned int other =
+        ~_mm_movemask_epi8 (_mm_andnot_si128 (_mm_cmpeq_epi8 (v, del),
+                                              _mm_cmpgt_epi8 (v, below)))
+        & 0xffff;
+      if (other)
+        return i + __builtin_ctz (other);
+    }
+  return i + printable_prefix_portable (p + i, n - i);
+}
+
+static size_t __attribute__ ((target ("avx2")))
+printable_prefix_avx2 (char const *p, size_t n)
+{
+  __m256i const below = _mm256_set1_epi8 (' ' - 1);
+  __m256i const del = _mm256_set1_epi8 (0x7f);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((void const *) (p + i));
+      unsigned int other =
+        ~_mm256_movemask_epi8 (_mm256_andnot_si256
+                               (_mm256_cmpeq_epi8 (v, del),
+                                _mm256_cmpgt_epi8 (v, below)));
+      if (other)
+        return i + __builtin_ctz (other);
+    }
+  return i + printable_prefix_portable (p + i, n - i);
+}
+
+/* These kernels look at a vector of bytes and the bytes after them.
+   A vector is copied down whole if it has no CRLF and a carriage return
+   has been removed before it, so that the bytes before the first CRLF
+   are not written, and byte by byte if it has one.  */
+
+static size_t
+strip_cr_sse2 (char *p, size_t n)
+{
+  __m128i const cr = _mm_set1_epi8 ('\r');
+  __m128i const nl = _mm_set1_epi8 ('\n');
+  char const *lim = p + n;
+  char *src = p;
+  char *dst = p;
+  while (16 < lim - src)
+    {
+      __m128i v = _mm_loadu_si128 ((void const *) src);
+      __m128i next = _mm_loadu_si128 ((void const *) (src + 1));
+      unsigned int crlf =
+        _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (v, cr),
+                                          _mm_cmpeq_epi8 (next, nl)));
+      if (crlf)
+        {
+          char block[16];
+          _mm_storeu_si128 ((void *) block, v);
+          for (int i = 0; i < 16; i++)
+            {
+              *dst = block[i];
+              dst += ! (crlf >> i & 1);
+            }
+        }
+      else
+        {
+          if (dst != src)
+            _mm_storeu_si128 ((void *) dst, v);
+          dst += 16;
+        }
+      src += 16;
+    }
+  size_t len = strip_cr_portable (src, lim - src);
+  if (dst != src)
+    memmove (dst, src, len);
+  return dst + len - p;
+}
+
+static size_t __attribute__ ((target ("avx2")))
+strip_cr_avx2 (char *p, size_t n)
+{
+  __m256i const cr = _mm256_set1_epi8 ('\r');
+  __m256i const nl = _mm256_set1_epi8 ('\n');
+  char const *lim = p + n;
+  char *src = p;
+  char *dst = p;
+  while (32 < lim - src)
+    {
+      __m256i v = _mm256_loadu_si256 ((void const *) src);
+      __m256i next = _mm256_loadu_si256 ((void const *) (src + 1));
+      unsigned int crlf =
+        _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (v, cr),
+                                                _mm256_cmpeq_epi8 (next, nl)));
+      if (crlf)
+        {
+          char block[32];
+          _mm256_storeu_si256 ((void *) block, v);
+          for (int i = 0; i < 32; i++)
+            {
+              *dst = block[i];
+              dst += ! (crlf >> i & 1);
+            }
+        }
+      else
+        {
+          if (dst != src)
+            _mm256_storeu_si256 ((void *) dst, v);
+          dst += 32;
+        }
+      src += 32;
+    }
+  size_t len = strip_cr_portable (src, lim - src);
+  if (dst != src)
+    memmove (dst, src, len);
+  return dst + len - p;
+}
+
+#endif
+
+char const *(*hash_line) (char const *, hash_value *) = hash_line_portable;
+size_t (*common_prefix) (char const *, char const *, size_t)
+  = common_prefix_portable;
+size_t (*common_suffix) (char const *, char const *, size_t)
+  = common_suffix_portable;
+size_t (*count_newlines) (char const *, size_t) = count_newlines_portable;
+size_t (*canon_line) (char const *, size_t, char *);
+size_t (*strip_cr) (char *, size_t) = strip_cr_portable;
+size_t (*printable_prefix) (char const *, size_t) = printable_prefix_portable;
+
+/* Select the kernels to use for the current options.  If PORTABLE,
+   use only the portable ones; this is for testing the others against
+   them.  */
+
+void
+init_scan (bool portable)
+{
+  bool ascii_case = true;
+  bool ascii_space = true;
+  for (int c = 0; c <= UCHAR_MAX; c++)
+    {
+      fold_table[c] = ignore_case ? tolower (c) : c;
+      space_table[c] = isspace (c) != 0;
+      ascii_space &= space_table[c] == (c == ' ' || ('\t' <= c && c <= '\r'));
+      ascii_case &= (fold_table[c]
+                     == (ignore_case && 'A' <= c && c <= 'Z'
+                         ? c - 'A' + 'a' : c));
+    }
+
+  char const *(*plain) (char const *, hash_value *) = hash_line_portable;
+
+#if SCAN_X86
+  if (! portable)
+    {
+      __builtin_cpu_init ();
+      if (__builtin_cpu_supports ("avx512bw"))
+        plain = hash_line_avx512;
+      else if (__builtin_cpu_supports ("avx2"))
+        plain = hash_line_avx2;
+      else
+        plain = hash_line_sse2;
+
+      if (__builtin_cpu_supports ("avx2"))
+        {
+          common_prefix = common_prefix_avx2;
+          common_suffix = common_suffix_avx2;
+          count_newlines = count_newlines_avx2;
+          strip_cr = strip_cr_avx2;
+          printable_prefix = printable_prefix_avx2;
+        }
+      else
+        {
+          common_prefix = common_prefix_sse2;
+          common_suffix = common_suffix_sse2;
+          count_newlines = count_newlines_sse2;
+          strip_cr = strip_cr_sse2;
+          printable_prefix = printable_prefix_sse2;
+        }
+    }
+#endif
+
+  if (ignore_white_space != IGNORE_NO_WHITE_SPACE)
+    hash_line = (hash_line_spaces_kernels[ignore_white_space][ignore_case]
+                 [ascii_case & ascii_space]);
+  else if (ignore_case)
+    hash_line = ascii_case ? hash_line_ascii_case : hash_line_case;
+  else
+    hash_line = plain;
+  canon_line = canon_line_kernels[ignore_white_space][ignore_case];
+
+#if SCAN_X86
+  if (! portable && ascii_case & ascii_space
+      && (ignore_white_space == IGNORE_SPACE_CHANGE
+          || ignore_white_space == IGNORE_ALL_SPACE)
+      && __builtin_cpu_supports ("ssse3")
+      && __builtin_cpu_supports ("popcnt"))
+    {
+      for (int m = 0; m <= UCHAR_MAX; m++)
+        {
+          uint64_t shuffle = 0;
+          for (int i = 7; 0 <= i; i--)
+            if (m >> i & 1)
+              shuffle = shuffle << 8 | i;
+          pack_shuffle[m] = shuffle;
+        }
+      hash_line = (ignore_white_space == IGNORE_SPACE_CHANGE
+                   ? (ignore_case
+                      ? hash_line_b_ascii_i_ssse3 : hash_line_b_ssse3)
+                   : (ignore_case
+                      ? hash_line_w_ascii_i_ssse3 : hash_line_w_ssse3));
+    }
+#endif
+}
@@ -40,7 +40,10 @@ print_sdiff_script (struct change *script)
   next0 = next1 = - files[0].prefix_lines;
   print_script (script, find_change, print_sdiff_hunk);
 
-  print_sdiff_common_lines (files[0].valid_lines, files[1].valid_lines);
+  /* With --max-hunks, the lines after the last hunk output are not
+     known to be common.  */
+  if (! hunk_limit_reached ())
+    print_sdiff_common_lines (files[0].valid_lines, files[1].valid_lines);
 }
 
 /* Tab from column FROM to column TO, where FROM <= TO.  Yield TO.  */
@@ -58,8 +61,7 @@ tab_from_to (size_t from, size_t to)
         putc ('\t', out);
         from = tab;
       }
-  while (from++ < to)
-    putc (' ', out);
+  output_spaces (to - from);
   return to;
 }
 
@@ -79,6 +81,20 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
 
   while (text_pointer < text_limit)
     {
+      /* Output printable ASCII characters, which each take a column,
+         in bulk, up to OUT_BOUND.  */
+      size_t n = printable_prefix (text_pointer, text_limit - text_pointer);
+      if (n && in_position < out_bound)
+        {
+          size_t shown = MIN (n, out_bound - in_position);
+          fwrite (text_pointer, 1, shown, out);
+          out_position = in_position + shown;
+        }
+      in_position += n;
+      text_pointer += n;
+      if (text_pointer == text_limit)
+        break;
+
       char const *tp0 = text_pointer;
       register char c = *text_pointer++;
 
@@ -94,8 +110,11 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
                   {
                     if (out_bound < tabstop)
                       tabstop = out_bound;
-                    for (;  out_position < tabstop;  out_position++)
-                      putc (' ', out);
+                    if (out_position < tabstop)
+                      {
+                        output_spaces (tabstop - out_position);
+                        out_position = tabstop;
+                      }
                   }
                 else
                   if (tabstop < out_bound)
@@ -120,9 +139,12 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
           if (in_position != 0 && --in_position < out_bound)
             {
               if (out_position <= in_position)
-                /* Add spaces to make up for suppressed tab past out_bound.  */
-                for (;  out_position < in_position;  out_position++)
-                  putc (' ', out);
+                {
+                  /* Add spaces to make up for suppressed tab past
+                     out_bound.  */
+                  output_spaces (in_position - out_position);
+                  out_position = in_position;
+                }
               else
                 {
                   out_position = in_position;
@@ -144,7 +166,7 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
                 if (in_position <= out_bound)
                   {
                     out_position = in_position;
-                    fwrite (tp0, 1, bytes, stdout);
+                    fwrite (tp0, 1, bytes, out);
                   }
                 text_pointer = tp0 + bytes;
                 break;
@@ -157,34 +179,6 @@ print_half_line (char const *const *line, size_t indent, size_t out_bound)
             putc (c, out);
           break;
 
-        case ' ': case '!': case '"': case '#': case '%':
-        case '&': case '\'': case '(': case ')': case '*':
-        case '+': case ',': case '-': case '.': case '/':
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9':
-        case ':': case ';': case '<': case '=': case '>':
-        case '?':
-        case 'A': case 'B': case 'C': case 'D': case 'E':
-        case 'F': case 'G': case 'H': case 'I': case 'J':
-        case 'K': case 'L': case 'M': case 'N': case 'O':
-        case 'P': case 'Q': case 'R': case 'S': case 'T':
-        case 'U': case 'V': case 'W': case 'X': case 'Y':
-        case 'Z':
-        case '[': case '\\': case ']': case '^': case '_':
-        case 'a': case 'b': case 'c': case 'd': case 'e':
-        case 'f': case 'g': case 'h': case 'i': case 'j':
-        case 'k': case 'l': case 'm': case 'n': case 'o':
-        case 'p': case 'q': case 'r': case 's': case 't':
-        case 'u': case 'v': case 'w': case 'x': case 'y':
-        case 'z': case '{': case '|': case '}': case '~':
-          /* These characters are printable ASCII characters.  */
-          if (in_position++ < out_bound)
-            {
-              out_position = in_position;
-              putc (c, out);
-            }
-          break;
-
         case '\n':
           return out_position;
         }
@@ -25,6 +25,7 @@
 #include <error.h>
 #include <system-quote.h>
 #include <xalloc.h>
+#include <xalloc-oversized.h>
 #include "xvasprintf.h"
 #include <signal.h>
 
@@ -159,6 +160,35 @@ print_message_queue (void)
     }
 }
 
+/* Print one of the counters gathered for ---stats.  */
+
+static void
+print_stat (char const *name, intmax_t value)
+{
+  error (0, 0, "%s: %"PRIdMAX, name, value);
+}
+
+/* Print the counters gathered for ---stats to standard error.  */
+
+void
+print_stats (void)
+{
+  print_stat ("lines hashed", stats.lines_hashed);
+  print_stat ("hash collisions", stats.hash_collisions);
+  print_stat ("probe collisions", stats.probe_collisions);
+  print_stat ("read nanoseconds", stats.read_nsec);
+  print_stat ("overlapped read nanoseconds", stats.read_overlap_nsec);
+  print_stat ("table bytes reallocated", stats.table_bytes_reallocated);
+  print_stat ("canonical forms built", stats.canonical_forms);
+  print_stat ("digest cache hits", stats.digest_cache_hits);
+  print_stat ("files digested", stats.files_digested);
+  print_stat ("subproblems spawned", stats.subproblems_spawned);
+  print_stat ("comparisons over half budget",
+              stats.comparisons_over_half_budget);
+  print_stat ("comparisons over budget", stats.comparisons_over_budget);
+  print_stat ("allocations saved", stats.allocations_saved);
+}
+
 /* The set of signals that are caught.  */
 
 static sigset_t caught_signals;
@@ -721,6 +751,10 @@ check_color_output (bool is_pipe)
     install_signal_handlers ();
 }
 
+/* The number of hunks output for the files being compared, for
+   --max-hunks.  */
+static intmax_t hunks_printed;
+
 /* Call before outputting the results of comparing files NAME0 and NAME1
    to set up OUTFILE, the stdio stream for the output to go to.
 
@@ -735,6 +769,7 @@ setup_output (char const *name0, char const *name1, bool recursive)
   current_name1 = name1;
   currently_recursive = recursive;
   outfile = 0;
+  hunks_printed = 0;
 }
 
 #if HAVE_WORKING_FORK
@@ -979,13 +1014,17 @@ finish_output (void)
 }
 
 /* Compare two lines (typically one from each input file)
-   according to the command line options.
+   according to the white space option IG_WHITE_SPACE, ignoring case
+   if FOLD.
    For efficiency, this is invoked only when the lines do not match exactly
    but an option like -i might cause us to ignore the difference.
-   Return nonzero if the lines differ.  */
+   Return nonzero if the lines differ.  This is a template: the
+   functions below instantiate it for each combination of options, so
+   that the options are not tested again for each differing byte.  */
 
-bool
-lines_differ (char const *s1, char const *s2)
+static inline bool _GL_ATTRIBUTE_ALWAYS_INLINE _GL_ATTRIBUTE_PURE
+lines_differ_template (char const *s1, char const *s2,
+                       enum DIFF_white_space ig_white_space, bool fold)
 {
   register char const *t1 = s1;
   register char const *t2 = s2;
@@ -999,7 +1038,7 @@ lines_differ (char const *s1, char const *s2)
       /* Test for exact char equality first, since it's a common case.  */
       if (c1 != c2)
         {
-          switch (ignore_white_space)
+          switch (ig_white_space)
             {
             case IGNORE_ALL_SPACE:
               /* For -w, just skip past any white space.  */
@@ -1087,7 +1126,7 @@ lines_differ (char const *s1, char const *s2)
                   /* Both lines have nothing but whitespace left.  */
                   return false;
                 }
-              if (ignore_white_space == IGNORE_TRAILING_SPACE)
+              if (ig_white_space == IGNORE_TRAILING_SPACE)
                 break;
               FALLTHROUGH;
             case IGNORE_TAB_EXPANSION:
@@ -1124,7 +1163,7 @@ lines_differ (char const *s1, char const *s2)
 
           /* Lowercase all letters if -i is specified.  */
 
-          if (ignore_case)
+          if (fold)
             {
               c1 = tolower (c1);
               c2 = tolower (c2);
@@ -1142,6 +1181,53 @@ lines_differ (char const *s1, char const *s2)
   return true;
 }
 
+/* Define NAME as lines_differ for the white space option
+   IG_WHITE_SPACE, ignoring case if FOLD.  */
+#define DEFINE_LINES_DIFFER(name, ig_white_space, fold)			\
+  static bool _GL_ATTRIBUTE_PURE					\
+  name (char const *s1, char const *s2)					\
+  {									\
+    return lines_differ_template (s1, s2, ig_white_space, fold);	\
+  }
+
+DEFINE_LINES_DIFFER (lines_differ_i, IGNORE_NO_WHITE_SPACE, true)
+DEFINE_LINES_DIFFER (lines_differ_E, IGNORE_TAB_EXPANSION, false)
+DEFINE_LINES_DIFFER (lines_differ_E_i, IGNORE_TAB_EXPANSION, true)
+DEFINE_LINES_DIFFER (lines_differ_Z, IGNORE_TRAILING_SPACE, false)
+DEFINE_LINES_DIFFER (lines_differ_Z_i, IGNORE_TRAILING_SPACE, true)
+DEFINE_LINES_DIFFER (lines_differ_EZ,
+                     IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE, false)
+DEFINE_LINES_DIFFER (lines_differ_EZ_i,
+                     IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE, true)
+DEFINE_LINES_DIFFER (lines_differ_b, IGNORE_SPACE_CHANGE, false)
+DEFINE_LINES_DIFFER (lines_differ_b_i, IGNORE_SPACE_CHANGE, true)
+DEFINE_LINES_DIFFER (lines_differ_w, IGNORE_ALL_SPACE, false)
+DEFINE_LINES_DIFFER (lines_differ_w_i, IGNORE_ALL_SPACE, true)
+
+/* The instances of lines_differ, indexed by white space option and by
+   whether case is ignored.  Lines that are not identical always differ
+   without either.  */
+static bool (*const lines_differ_kernels[][2]) (char const *, char const *) =
+  {
+    [IGNORE_NO_WHITE_SPACE] = { NULL, lines_differ_i },
+    [IGNORE_TAB_EXPANSION] = { lines_differ_E, lines_differ_E_i },
+    [IGNORE_TRAILING_SPACE] = { lines_differ_Z, lines_differ_Z_i },
+    [IGNORE_TAB_EXPANSION_AND_TRAILING_SPACE]
+      = { lines_differ_EZ, lines_differ_EZ_i },
+    [IGNORE_SPACE_CHANGE] = { lines_differ_b, lines_differ_b_i },
+    [IGNORE_ALL_SPACE] = { lines_differ_w, lines_differ_w_i },
+  };
+
+bool (*lines_differ) (char const *, char const *);
+
+/* Select the instance of lines_differ for the current options.  */
+
+void
+init_lines_differ (void)
+{
+  lines_differ = lines_differ_kernels[ignore_white_space][ignore_case];
+}
+
 /* Find the consecutive changes at the start of the script START.
    Return the last link before the first gap.  */
 
@@ -1157,8 +1243,18 @@ find_reverse_change (struct change *start)
   return start;
 }
 
+/* Return true if --max-hunks hunks have been output for the files
+   being compared, so that no more of them should be compared.  */
+
+bool _GL_ATTRIBUTE_PURE
+hunk_limit_reached (void)
+{
+  return max_hunks && max_hunks <= hunks_printed;
+}
+
 /* Divide SCRIPT into pieces by calling HUNKFUN and
-   print each piece with PRINTFUN.
+   print each piece with PRINTFUN, stopping after --max-hunks
+   hunks.
    Both functions take one arg, an edit script.
 
    HUNKFUN is called with the tail of the script
@@ -1175,7 +1271,7 @@ print_script (struct change *script,
 {
   struct change *next = script;
 
-  while (next)
+  while (next && ! hunk_limit_reached ())
     {
       struct change *this, *end;
 
@@ -1191,8 +1287,14 @@ print_script (struct change *script,
       debug_script (this);
 #endif
 
-      /* Print this hunk.  */
+      /* Print this hunk, and count it if it is not ignored.  */
       (*printfun) (this);
+      if (max_hunks)
+        {
+          lin first0, last0, first1, last1;
+          hunks_printed += !!analyze_hunk (this, &first0, &last0,
+                                            &first1, &last1);
+        }
 
       /* Reconnect the script so it will all be freed properly.  */
       end->link = next;
@@ -1286,52 +1388,71 @@ output_1_line (char const *base, char const *limit, char const *flag_format,
       register char const *t = base;
       register size_t column = 0;
       size_t tab_size = tabsize;
-      size_t counter_proc_signals = 0;
 
       while (t < limit)
         {
-          counter_proc_signals++;
-          if (counter_proc_signals == MAX_CHUNK)
+          char const *chunk_limit = t + MIN (limit - t, MAX_CHUNK);
+          while (t < chunk_limit)
             {
-              process_signals ();
-              counter_proc_signals = 0;
-            }
+              /* Copy printable ASCII characters, which each take a
+                 column, in bulk.  */
+              size_t n = printable_prefix (t, chunk_limit - t);
+              fwrite (t, 1, n, out);
+              t += n;
+              column += n;
+              if (t == chunk_limit)
+                break;
 
-          switch ((c = *t++))
-            {
-            case '\t':
-              {
-                size_t spaces = tab_size - column % tab_size;
-                column += spaces;
-                do
-                  putc (' ', out);
-                while (--spaces);
-              }
-              break;
+              switch ((c = *t++))
+                {
+                case '\t':
+                  {
+                    size_t spaces = tab_size - column % tab_size;
+                    column += spaces;
+                    output_spaces (spaces);
+                  }
+                  break;
 
-            case '\r':
-              putc (c, out);
-              if (flag_format && t < limit && *t != '\n')
-                fprintf (out, flag_format, line_flag);
-              column = 0;
-              break;
+                case '\r':
+                  putc (c, out);
+                  if (flag_format && t < limit && *t != '\n')
+                    fprintf (out, flag_format, line_flag);
+                  column = 0;
+                  break;
 
-            case '\b':
-              if (column == 0)
-                continue;
-              column--;
-              putc (c, out);
-              break;
+                case '\b':
+                  if (column == 0)
+                    continue;
+                  column--;
+                  putc (c, out);
+                  break;
 
-            default:
-              column += isprint (c) != 0;
-              putc (c, out);
-              break;
+                default:
+                  column += isprint (c) != 0;
+                  putc (c, out);
+                  break;
+                }
             }
+          process_signals ();
         }
     }
 }
 
+/* Output N spaces.  */
+
+void
+output_spaces (size_t n)
+{
+  static char const spaces[] = "                                "
+                               "                                ";
+  while (sizeof spaces - 1 < n)
+    {
+      fwrite (spaces, 1, sizeof spaces - 1, outfile);
+      n -= sizeof spaces - 1;
+    }
+  fwrite (spaces, 1, n, outfile);
+}
+
 enum indicator_no
   {
     C_LEFT, C_RIGHT, C_END, C_RESET, C_HEADER, C_ADD, C_DELETE, C_LINE
@@ -1390,13 +1511,14 @@ char const change_letter[] = { 0, 'd', 'a', 'c' };
    into an actual line number in the input file.
    The internal line number is I.  FILE points to the data on the file.
 
-   Internal line numbers count from 0 starting after the prefix.
+   Internal line numbers count from 0 starting after the prefix
+   of the file or, with --max-memory, of the window being compared.
    Actual line numbers count from 1 within the entire file.  */
 
 lin _GL_ATTRIBUTE_PURE
 translate_line_number (struct file_data const *file, lin i)
 {
-  return i + file->prefix_lines + 1;
+  return i + file->window_lines + file->prefix_lines + 1;
 }
 
 /* Translate a line number range.  This is always done for printing,
@@ -1556,6 +1678,89 @@ zalloc (size_t size)
   memset (p, 0, size);
   return p;
 }
+
+/* Blocks kept from one comparison for the next, so that comparing
+   many pairs of small files, as with -r, does not allocate and free
+   the same blocks over and over.  Each holds the largest block given
+   back to it so far.  While it is taken, it remembers the block, its
+   real size, and whether it was reused.  Only the main thread uses
+   them.  */
+static struct
+{
+  void *block;
+  size_t size;
+  void *taken;
+  size_t taken_size;
+  bool reused;
+} spares[SPARES];
+
+/* Yield a block of at least N * S bytes for the use of WHICH, reusing
+   the spare one if it is big enough.  */
+
+void *
+spare_take (enum spare which, size_t n, size_t s)
+{
+  void *p = spares[which].block;
+  size_t size = spares[which].size;
+
+  if (xalloc_oversized (n, s))
+    xalloc_die ();
+  spares[which].reused = p && n * s <= size;
+  if (! spares[which].reused)
+    {
+      free (p);
+      size = n * s;
+      p = xmalloc (size);
+    }
+  spares[which].block = NULL;
+  spares[which].size = 0;
+  spares[which].taken = p;
+  spares[which].taken_size = size;
+  return p;
+}
+
+/* Return the size of the block that spare_take last yielded for WHICH,
+   which may be more than was asked for.  */
+
+size_t _GL_ATTRIBUTE_PURE
+spare_size (enum spare which)
+{
+  return spares[which].taken_size;
+}
+
+/* Like spare_take, but initialize the N * S bytes to zero.  */
+
+void *
+spare_ztake (enum spare which, size_t n, size_t s)
+{
+  void *p = spare_take (which, n, s);
+  memset (p, 0, n * s);
+  return p;
+}
+
+/* Give back the block P of at least SIZE bytes that spare_take
+   yielded for WHICH, or that replaced one it yielded, keeping it if it
+   is the largest yet.  */
+
+void
+spare_give (enum spare which, void *p, size_t size)
+{
+  if (p && p == spares[which].taken)
+    {
+      size = MAX (size, spares[which].taken_size);
+      stats.allocations_saved += spares[which].reused;
+    }
+  spares[which].taken = NULL;
+  spares[which].taken_size = 0;
+  if (spares[which].size < size)
+    {
+      free (spares[which].block);
+      spares[which].block = p;
+      spares[which].size = size;
+    }
+  else
+    free (p);
+}
 
 void
 debug_script (struct change *sp)